@@ -0,0 +1,707 @@
+// Benchmark for init_main.c, run outside PID 1.
+//
+//   cc -O2 -o init_bench init_bench.c
+//   init_bench [-n services]... [-t] [-k] [-w seconds] supervisor...
+//   init_bench -c [-k] [-w seconds] supervisor...
+//
+// Each supervisor binary, e.g. builds of two revisions, is started with
+// INIT_ROOT pointing at a scratch tree holding a generated inittab of
+// synthetic services, once per -n count (10 to 10,000 by default). The
+// services are this program again, through one symlink each: they report
+// their start over a datagram socket and then sleep until killed. Every run
+// measures
+//
+//   boot      start of the supervisor until every service has reported
+//   spawn/s   services started per second during boot
+//   storm     every service SIGKILLed at once until all have come back,
+//             median and 99th percentile per service
+//   reap lag  the supervisor's own mean SIGCHLD-to-waitpid() time, from its
+//             metrics
+//   reload    one service added and SIGHUP sent until it has reported
+//   ctl/s     status requests answered per second on one control connection,
+//             with CTL_WINDOW of them pipelined
+//   log MB/s  log bytes written per second spent in log_flush()
+//   shutdown  SIGTERM until the supervisor has exited
+//
+// -t makes service k depend on service (k-1)/2, so boot has to follow a
+// binary tree instead of starting everything at once. We are a subreaper, so
+// services orphaned by a supervisor that died are still ours to clean up. -k
+// keeps the scratch trees for inspection.
+//
+// -c runs scripted supervision checks instead, each reported as ok or
+// FAILED, and exits non-zero if any failed.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "init_ctl.h"
+#include "init_log.h"
+
+#define MAX_COUNTS 16
+#define REPORT_BUFFER (4 * 1024 * 1024) // Receive buffer of the report socket, so services rarely block on it
+#define CTL_WINDOW 32                   // Control requests in flight, below the supervisor's CTL_BATCH
+#define CTL_REQUESTS 100000             // Control requests per ctl/s measurement
+#define LOG_ROTATE_SIZE (1024 * 1024)   // The supervisor's MAX_LOG_SIZE
+
+// What a service sends once it is running
+typedef struct {
+    uint32_t index;
+    int32_t pid;
+    uint64_t time_us; // CLOCK_MONOTONIC
+} Report;
+
+// One supervisor run against one generated inittab
+typedef struct {
+    char root[64];
+    pid_t supervisor;
+    int reports;      // Bound report socket
+    uint32_t count;   // Services, not counting the one added for the reload
+    pid_t *pids;      // Last reported PID of each service
+    uint64_t *times;  // Last report time of each service
+    bool *seen;
+    bool binary_log;  // Started with INIT_LOG_FORMAT=binary
+} Run;
+
+bool tree = false;
+bool keep = false;
+bool checks = false;
+int wait_seconds = 60;
+
+uint64_t monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n services]... [-t] [-k] [-w seconds] supervisor...\n", prog);
+    fprintf(stderr, "       %s -c [-k] [-w seconds] supervisor...\n", prog);
+    return EXIT_FAILURE;
+}
+
+// Service mode: report, then sleep until SIGTERM or SIGKILL
+int run_service(const char *report, const char *argv0) {
+    const char *base = strrchr(argv0, '/');
+    Report r = {strtoul(base ? base + 2 : argv0 + 1, NULL, 10), getpid(), monotonic_us()};
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, report, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || sendto(fd, &r, sizeof(r), 0, (struct sockaddr *)&addr, sizeof(addr)) != sizeof(r)) {
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    while (1) pause();
+}
+
+int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st, (void)flag, (void)ftw;
+    remove(path);
+    return 0;
+}
+
+bool write_file(const char *path, const char *mode, const char *text) {
+    FILE *f = fopen(path, mode);
+    if (!f) return false;
+    bool ok = fputs(text, f) >= 0;
+    return fclose(f) == 0 && ok;
+}
+
+// Add service k to the tree and the inittab
+bool add_service(Run *run, uint32_t k, const char *self) {
+    char path[PATH_MAX], line[3 * PATH_MAX];
+    snprintf(path, sizeof(path), "%s/bin/s%u", run->root, k);
+    if (symlink(self, path) < 0) {
+        perror(path);
+        return false;
+    }
+    if (tree && k > 0 && k < run->count) {
+        snprintf(line, sizeof(line), "0 %s %s/bin/s%u 0 0\n", path, run->root, (k - 1) / 2);
+    } else {
+        snprintf(line, sizeof(line), "0 %s - 0 0\n", path);
+    }
+    snprintf(path, sizeof(path), "%s/etc/inittab", run->root);
+    return write_file(path, "a", line);
+}
+
+bool setup(Run *run, uint32_t count, const char *self) {
+    strcpy(run->root, "/tmp/init-bench.XXXXXX");
+    if (!mkdtemp(run->root)) {
+        perror("mkdtemp");
+        return false;
+    }
+    static const char *const dirs[] = {"etc", "var", "var/log", "var/lib", "var/lib/init", "run", "bin"};
+    char path[PATH_MAX];
+    for (size_t k = 0; k < sizeof(dirs) / sizeof(dirs[0]); k++) {
+        snprintf(path, sizeof(path), "%s/%s", run->root, dirs[k]);
+        mkdir(path, 0755);
+    }
+    run->count = count;
+    run->pids = calloc(count + 1, sizeof(pid_t));
+    run->times = calloc(count + 1, sizeof(uint64_t));
+    run->seen = calloc(count + 1, sizeof(bool));
+    if (!run->pids || !run->times || !run->seen) {
+        perror("calloc");
+        return false;
+    }
+    snprintf(path, sizeof(path), "%s/etc/inittab", run->root);
+    if (!write_file(path, "w", "")) {
+        perror(path);
+        return false;
+    }
+    for (uint32_t k = 0; k < count; k++) {
+        if (!add_service(run, k, self)) return false;
+    }
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/report", run->root);
+    run->reports = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    int buffer = REPORT_BUFFER;
+    setsockopt(run->reports, SOL_SOCKET, SO_RCVBUFFORCE, &buffer, sizeof(buffer));
+    if (run->reports < 0 || bind(run->reports, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("report socket");
+        return false;
+    }
+    return true;
+}
+
+// Wait until services [from, to) have all reported once since the last
+// call. Fills in pids and times; false if it takes longer than -w.
+bool await_reports(Run *run, uint32_t from, uint32_t to) {
+    memset(run->seen + from, 0, (to - from) * sizeof(bool));
+    uint32_t missing = to - from;
+    uint64_t deadline = monotonic_us() + (uint64_t)wait_seconds * 1000000;
+    while (missing > 0) {
+        struct pollfd pfd = {run->reports, POLLIN, 0};
+        uint64_t now = monotonic_us();
+        if (now >= deadline || poll(&pfd, 1, (deadline - now) / 1000 + 1) < 0) break;
+        Report r;
+        while (recv(run->reports, &r, sizeof(r), MSG_DONTWAIT) == sizeof(r)) {
+            if (r.index < from || r.index >= to) continue;
+            run->pids[r.index] = r.pid;
+            run->times[r.index] = r.time_us;
+            if (!run->seen[r.index]) {
+                run->seen[r.index] = true;
+                missing--;
+            }
+        }
+        if (waitpid(run->supervisor, NULL, WNOHANG) == run->supervisor) {
+            fprintf(stderr, "%s: supervisor exited\n", run->root);
+            run->supervisor = 0;
+            return false;
+        }
+    }
+    if (missing > 0) {
+        fprintf(stderr, "%s: %u services did not start within %d s\n", run->root, missing, wait_seconds);
+    }
+    return missing == 0;
+}
+
+// Whether no service reports for ms milliseconds
+bool no_reports(Run *run, int ms) {
+    uint64_t deadline = monotonic_us() + (uint64_t)ms * 1000;
+    for (uint64_t now = monotonic_us(); now < deadline; now = monotonic_us()) {
+        struct pollfd pfd = {run->reports, POLLIN, 0};
+        if (poll(&pfd, 1, (deadline - now) / 1000 + 1) > 0) return false;
+    }
+    return true;
+}
+
+// A connection to the supervisor's control socket, -1 if there is none
+int ctl_connect(Run *run) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s%s", run->root, CTL_SOCKET_PATH);
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Wait for the control socket, which the supervisor opens only once it has
+// started the services; false if it takes longer than -w
+bool await_control(Run *run) {
+    uint64_t deadline = monotonic_us() + (uint64_t)wait_seconds * 1000000;
+    int fd;
+    while ((fd = ctl_connect(run)) < 0) {
+        if (monotonic_us() >= deadline) {
+            fprintf(stderr, "%s: no control socket within %d s\n", run->root, wait_seconds);
+            return false;
+        }
+        usleep(1000);
+    }
+    close(fd);
+    return true;
+}
+
+// Queue a request without waiting for its answer
+bool ctl_send(int fd, uint32_t tag, CtlOp op, const char *name) {
+    char buf[sizeof(CtlRequest) + CTL_NAME_MAX];
+    size_t len = name ? strlen(name) : 0;
+    if (len > CTL_NAME_MAX) return false;
+    CtlRequest req = {tag, op, len, 0};
+    memcpy(buf, &req, sizeof(req));
+    memcpy(buf + sizeof(req), name, len);
+    return send(fd, buf, sizeof(req) + len, 0) == (ssize_t)(sizeof(req) + len);
+}
+
+// One request about a service on its own connection
+bool ctl_request(Run *run, CtlOp op, const char *name, CtlResponse *resp) {
+    int fd = ctl_connect(run);
+    bool ok = fd >= 0 && ctl_send(fd, 0, op, name) && recv(fd, resp, sizeof(*resp), 0) == sizeof(*resp);
+    if (fd >= 0) close(fd);
+    return ok && resp->status == CTL_OK;
+}
+
+// Status requests about a service answered per second, keeping CTL_WINDOW of
+// them in flight on one connection; 0 on any failure
+double ctl_rate(Run *run, const char *name) {
+    int fd = ctl_connect(run);
+    if (fd < 0) return 0;
+    uint64_t started = monotonic_us();
+    uint32_t sent = 0, answered = 0;
+    bool ok = true;
+    while (ok && answered < CTL_REQUESTS) {
+        while (ok && sent < CTL_REQUESTS && sent - answered < CTL_WINDOW) {
+            ok = ctl_send(fd, sent++, CTL_STATUS, name);
+        }
+        CtlResponse resp;
+        ok = ok && recv(fd, &resp, sizeof(resp), 0) == sizeof(resp) && resp.tag == answered++ &&
+             resp.status == CTL_OK;
+    }
+    double elapsed = (monotonic_us() - started) / 1e6;
+    close(fd);
+    if (!ok) fprintf(stderr, "%s: control request %u failed\n", run->root, answered);
+    return ok && elapsed > 0 ? CTL_REQUESTS / elapsed : 0;
+}
+
+// Fetch the supervisor's Prometheus text; the caller frees it.
+char *fetch_metrics(Run *run) {
+    int fd = ctl_connect(run);
+    if (fd < 0 || !ctl_send(fd, 0, CTL_METRICS, NULL)) {
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    CtlResponse resp;
+    struct iovec iov = {&resp, sizeof(resp)};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                         .msg_controllen = sizeof(control.buf)};
+    ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    close(fd);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (n != sizeof(resp) || resp.status != CTL_OK || !cmsg || cmsg->cmsg_type != SCM_RIGHTS) return NULL;
+    int memfd;
+    memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+    struct stat st;
+    char *text = fstat(memfd, &st) == 0 ? malloc(st.st_size + 1) : NULL;
+    if (text && pread(memfd, text, st.st_size, 0) == st.st_size) {
+        text[st.st_size] = '\0';
+    } else {
+        free(text);
+        text = NULL;
+    }
+    close(memfd);
+    return text;
+}
+
+// Value of an unlabelled sample in Prometheus text, or 0
+double metric(const char *text, const char *name) {
+    size_t len = strlen(name);
+    for (const char *line = text; line && *line; line = strchr(line, '\n'), line = line ? line + 1 : NULL) {
+        if (strncmp(line, name, len) == 0 && line[len] == ' ') return strtod(line + len + 1, NULL);
+    }
+    return 0;
+}
+
+// Bytes in the log and its rotated copies
+double log_bytes(Run *run) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/var/log", run->root);
+    DIR *dir = opendir(path);
+    double total = 0;
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir))) {
+        struct stat st;
+        if (strncmp(entry->d_name, "init.log", 8) == 0 && fstatat(dirfd(dir), entry->d_name, &st, 0) == 0) {
+            total += st.st_size;
+        }
+    }
+    if (dir) closedir(dir);
+    return total;
+}
+
+int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Kill whatever the supervisor left behind, which the subreaper made ours
+void cleanup(Run *run) {
+    if (run->supervisor > 0) {
+        kill(run->supervisor, SIGKILL);
+        waitpid(run->supervisor, NULL, 0);
+    }
+    for (uint32_t k = 0; run->pids && k <= run->count; k++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/stat", run->pids[k]);
+        FILE *f = run->pids[k] > 0 ? fopen(path, "r") : NULL;
+        int ppid = 0;
+        if (f && fscanf(f, "%*d %*s %*c %d", &ppid) == 1 && ppid == getpid()) kill(run->pids[k], SIGKILL);
+        if (f) fclose(f);
+    }
+    while (waitpid(-1, NULL, 0) > 0) {
+    }
+    if (run->reports >= 0) close(run->reports);
+    if (!keep) nftw(run->root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    free(run->pids);
+    free(run->times);
+    free(run->seen);
+}
+
+// Start the supervisor on the run's tree. Without fast_restarts it keeps its
+// default backoff and crash-loop limit.
+bool launch(Run *run, const char *supervisor, bool fast_restarts) {
+    char report[PATH_MAX];
+    snprintf(report, sizeof(report), "%s/report", run->root);
+    run->supervisor = fork();
+    if (run->supervisor == 0) {
+        setenv("INIT_ROOT", run->root, 1);
+        setenv("INIT_BENCH_REPORT", report, 1);
+        if (fast_restarts) {
+            setenv("INIT_RESTART_DELAY_MAX", "1", 1); // So the storm measures reaping, not backoff
+            setenv("INIT_RESTART_LIMIT", "65535", 1); // The most restart_count can count
+        }
+        if (run->binary_log) setenv("INIT_LOG_FORMAT", "binary", 1);
+        execl(supervisor, supervisor, (char *)NULL);
+        perror(supervisor);
+        _exit(127);
+    }
+    return run->supervisor > 0;
+}
+
+bool bench(const char *supervisor, uint32_t count, const char *self) {
+    Run run = {.reports = -1};
+    bool ok = setup(&run, count, self);
+    if (!ok) {
+        cleanup(&run);
+        return false;
+    }
+
+    uint64_t started = monotonic_us();
+    if (!launch(&run, supervisor, true) || !await_reports(&run, 0, count)) {
+        cleanup(&run);
+        return false;
+    }
+    uint64_t first = UINT64_MAX, last = 0;
+    for (uint32_t k = 0; k < count; k++) {
+        if (run.times[k] < first) first = run.times[k];
+        if (run.times[k] > last) last = run.times[k];
+    }
+    double boot_ms = (last - started) / 1000.0;
+    double spawn_rate = last > first ? (count - 1) / ((last - first) / 1e6) : 0;
+
+    // Exit storm
+    uint64_t storm = monotonic_us();
+    for (uint32_t k = 0; k < count; k++) {
+        kill(run.pids[k], SIGKILL);
+    }
+    if (!await_reports(&run, 0, count)) {
+        cleanup(&run);
+        return false;
+    }
+    for (uint32_t k = 0; k < count; k++) {
+        run.times[k] -= storm;
+    }
+    qsort(run.times, count, sizeof(uint64_t), compare_u64);
+    double storm_p50_ms = run.times[count / 2] / 1000.0;
+    double storm_p99_ms = run.times[count * 99 / 100] / 1000.0;
+
+    // Reload adding one service
+    if (!add_service(&run, count, self)) {
+        cleanup(&run);
+        return false;
+    }
+    uint64_t reload = monotonic_us();
+    kill(run.supervisor, SIGHUP);
+    if (!await_reports(&run, count, count + 1)) {
+        cleanup(&run);
+        return false;
+    }
+    double reload_ms = (run.times[count] - reload) / 1000.0;
+
+    char service[PATH_MAX];
+    snprintf(service, sizeof(service), "%s/bin/s0", run.root);
+    double ctl_per_second = ctl_rate(&run, service);
+
+    char *metrics = fetch_metrics(&run);
+    double reap_count = metrics ? metric(metrics, "init_reap_lag_seconds_count") : 0;
+    double reap_lag_us = reap_count ? metric(metrics, "init_reap_lag_seconds_sum") * 1e6 / reap_count : 0;
+    double flush_seconds = metrics ? metric(metrics, "init_log_flush_seconds_sum") : 0;
+    free(metrics);
+    if (!metrics) fprintf(stderr, "%s: no metrics from the supervisor\n", run.root);
+
+    uint64_t shutdown = monotonic_us();
+    kill(run.supervisor, SIGTERM);
+    waitpid(run.supervisor, NULL, 0);
+    run.supervisor = 0;
+    double shutdown_ms = (monotonic_us() - shutdown) / 1000.0;
+    double log_mbps = flush_seconds > 0 ? log_bytes(&run) / flush_seconds / 1e6 : 0;
+
+    printf("%8u %9.1fms %9.0f %9.1fms %9.1fms %9.1fus %9.1fms %9.0f %9.1f %9.1fms\n", count, boot_ms, spawn_rate,
+           storm_p50_ms, storm_p99_ms, reap_lag_us, reload_ms, ctl_per_second, log_mbps, shutdown_ms);
+    fflush(stdout);
+    cleanup(&run);
+    return true;
+}
+
+// Checks, -c. Each gets a fresh tree with one service, s0, already running,
+// and fails with a message on stderr.
+typedef bool (*Check)(Run *run, const char *service);
+
+const char *state_name(const CtlResponse *resp) {
+    return resp->state < STATE_COUNT ? state_names[resp->state] : "?";
+}
+
+// Whether the service stays stopped: it does not report again and its
+// supervisor agrees.
+bool stays_stopped(Run *run, const char *service, const char *how) {
+    CtlResponse resp = {0};
+    if (no_reports(run, 1000) && ctl_request(run, CTL_STATUS, service, &resp) && resp.state == STATE_STOPPED) {
+        return true;
+    }
+    fprintf(stderr, "%s: stopped %s, but it is %s\n", run->root, how, state_name(&resp));
+    return false;
+}
+
+// Stopped while its restart backoff runs, a crashed service is not restarted
+// when the backoff ends.
+bool check_stop_in_backoff(Run *run, const char *service) {
+    for (int k = 0; k < 3; k++) { // Backoffs of at most 100, 200 and 400 ms
+        kill(run->pids[0], SIGKILL);
+        if (!await_reports(run, 0, 1)) return false;
+    }
+    kill(run->pids[0], SIGKILL); // This backoff is at least 400 ms
+    uint64_t deadline = monotonic_us() + 300000;
+    CtlResponse resp = {0};
+    while (ctl_request(run, CTL_STATUS, service, &resp) && resp.state != STATE_CRASHED && monotonic_us() < deadline) {
+        usleep(1000);
+    }
+    if (resp.state != STATE_CRASHED || !ctl_request(run, CTL_STOP, service, &resp) || resp.state != STATE_STOPPED) {
+        fprintf(stderr, "%s: stopping it in backoff left it %s\n", run->root, state_name(&resp));
+        return false;
+    }
+    return stays_stopped(run, service, "in backoff");
+}
+
+// Stopped after a restart but before the old instance is gone, a service is
+// not started again when it is reaped. The service is held with SIGSTOP, so
+// its SIGTERM stays pending until both requests are answered.
+bool check_stop_while_restarting(Run *run, const char *service) {
+    kill(run->pids[0], SIGSTOP);
+    int fd = ctl_connect(run);
+    CtlResponse restarted = {0}, stopped = {0};
+    bool answered = fd >= 0 && ctl_send(fd, 1, CTL_RESTART, service) && ctl_send(fd, 2, CTL_STOP, service) &&
+                    recv(fd, &restarted, sizeof(restarted), 0) == sizeof(restarted) &&
+                    recv(fd, &stopped, sizeof(stopped), 0) == sizeof(stopped);
+    if (fd >= 0) close(fd);
+    kill(run->pids[0], SIGCONT);
+    if (!answered || restarted.state != STATE_RESTARTING || stopped.state != STATE_STOPPING) {
+        fprintf(stderr, "%s: restart then stop left it %s, then %s\n", run->root, state_name(&restarted),
+                state_name(&stopped));
+        return false;
+    }
+    return stays_stopped(run, service, "while restarting");
+}
+
+// Whether a binary log file decodes without the gaps in its sequence numbers
+// that init_logdump warns about
+bool log_file_contiguous(const char *path) {
+    FILE *in = fopen(path, "rb");
+    char magic[LOG_BINARY_MAGIC_LEN];
+    bool ok = in && fread(magic, 1, sizeof(magic), in) == sizeof(magic) &&
+              memcmp(magic, LOG_BINARY_MAGIC, sizeof(magic)) == 0;
+    uint32_t expected = 0;
+    bool first = true;
+    LogRecord rec;
+    while (ok && fread(&rec, sizeof(rec), 1, in) == 1) {
+        if (!first && rec.sequence != expected && rec.sequence != 0) { // 0 means init restarted
+            fprintf(stderr, "%s: %u records missing before sequence %u\n", path, rec.sequence - expected,
+                    rec.sequence);
+            ok = false;
+        }
+        first = false;
+        expected = rec.sequence + 1;
+        ok = ok && fseek(in, (sizeof(LogRecord) + rec.text_len + 7) / 8 * 8 - sizeof(LogRecord), SEEK_CUR) == 0;
+    }
+    if (!in) perror(path);
+    if (in) fclose(in);
+    return ok;
+}
+
+// Every binary log file, the rotated ones included, decodes without gaps.
+// Switches to the current runlevel log one record each and start nothing, so
+// they fill a few log files quickly.
+bool check_log_rotation(Run *run, const char *service) {
+    (void)service;
+    uint32_t switches = 3 * LOG_ROTATE_SIZE / sizeof(LogRecord);
+    int fd = ctl_connect(run);
+    uint32_t sent = 0, answered = 0;
+    bool ok = fd >= 0;
+    while (ok && answered < switches) {
+        while (ok && sent < switches && sent - answered < CTL_WINDOW) {
+            CtlRequest req = {sent++, CTL_SWITCH, 0, 0};
+            ok = send(fd, &req, sizeof(req), 0) == sizeof(req);
+        }
+        CtlResponse resp;
+        ok = ok && recv(fd, &resp, sizeof(resp), 0) == sizeof(resp) && resp.status == CTL_OK;
+        answered++;
+    }
+    if (fd >= 0) close(fd);
+    if (!ok) {
+        fprintf(stderr, "%s: runlevel switch %u failed\n", run->root, answered);
+        return false;
+    }
+    kill(run->supervisor, SIGTERM); // So everything is flushed
+    waitpid(run->supervisor, NULL, 0);
+    run->supervisor = 0;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/var/log", run->root);
+    DIR *dir = opendir(path);
+    int files = 0;
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir))) {
+        if (strncmp(entry->d_name, "init.log.bin", 12) != 0) continue;
+        snprintf(path, sizeof(path), "%s/var/log/%s", run->root, entry->d_name);
+        if (!log_file_contiguous(path)) ok = false;
+        files++;
+    }
+    if (dir) closedir(dir);
+    if (files < 2) {
+        fprintf(stderr, "%s: %d binary log files, expected rotated ones too\n", run->root, files);
+        ok = false;
+    }
+    return ok;
+}
+
+bool check(const char *supervisor, const char *self, const char *name, Check fn, bool binary_log) {
+    Run run = {.reports = -1, .binary_log = binary_log};
+    bool ok = setup(&run, 1, self) && launch(&run, supervisor, false) && await_reports(&run, 0, 1) &&
+              await_control(&run);
+    if (ok) {
+        char service[PATH_MAX];
+        snprintf(service, sizeof(service), "%s/bin/s0", run.root);
+        ok = fn(&run, service);
+    }
+    if (run.supervisor > 0) {
+        kill(run.supervisor, SIGTERM); // Let it clean up after itself, see cleanup() for the rest
+        waitpid(run.supervisor, NULL, 0);
+        run.supervisor = 0;
+    }
+    printf("%-32s %s\n", name, ok ? "ok" : "FAILED");
+    fflush(stdout);
+    cleanup(&run);
+    return ok;
+}
+
+bool run_checks(const char *supervisor, const char *self) {
+    static const struct {
+        const char *name;
+        Check fn;
+        bool binary_log;
+    } all[] = {
+        {"stop in restart backoff", check_stop_in_backoff, false},
+        {"stop while restarting", check_stop_while_restarting, false},
+        {"binary log rotation", check_log_rotation, true},
+    };
+    bool ok = true;
+    for (size_t k = 0; k < sizeof(all) / sizeof(all[0]); k++) {
+        if (!check(supervisor, self, all[k].name, all[k].fn, all[k].binary_log)) ok = false;
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    const char *report = getenv("INIT_BENCH_REPORT");
+    if (report) {
+        return run_service(report, argv[0]);
+    }
+
+    uint32_t counts[MAX_COUNTS], count_count = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:tkcw:")) != -1) {
+        if (opt == 'n' && count_count < MAX_COUNTS && atoi(optarg) > 0) {
+            counts[count_count++] = atoi(optarg);
+        } else if (opt == 't') {
+            tree = true;
+        } else if (opt == 'k') {
+            keep = true;
+        } else if (opt == 'c') {
+            checks = true;
+        } else if (opt == 'w' && atoi(optarg) > 0) {
+            wait_seconds = atoi(optarg);
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (optind == argc) {
+        return usage(argv[0]);
+    }
+    if (count_count == 0) {
+        static const uint32_t defaults[] = {10, 100, 1000, 10000};
+        memcpy(counts, defaults, sizeof(defaults));
+        count_count = sizeof(defaults) / sizeof(defaults[0]);
+    }
+
+    char self[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len < 0) {
+        perror("/proc/self/exe");
+        return EXIT_FAILURE;
+    }
+    self[len] = '\0';
+    prctl(PR_SET_CHILD_SUBREAPER, 1);
+
+    int status = EXIT_SUCCESS;
+    for (int k = optind; k < argc; k++) {
+        char supervisor[PATH_MAX];
+        if (!realpath(argv[k], supervisor)) {
+            perror(argv[k]);
+            status = EXIT_FAILURE;
+            continue;
+        }
+        if (checks) {
+            printf("%s\n", supervisor);
+            if (!run_checks(supervisor, self)) status = EXIT_FAILURE;
+            continue;
+        }
+        printf("%s%s\n", supervisor, tree ? " (tree dependencies)" : "");
+        printf("%8s %11s %9s %11s %11s %11s %11s %9s %9s %11s\n", "SERVICES", "BOOT", "SPAWN/S", "STORM_P50",
+               "STORM_P99", "REAP_LAG", "RELOAD", "CTL/S", "LOG_MB/S", "SHUTDOWN");
+        for (uint32_t n = 0; n < count_count; n++) {
+            if (!bench(supervisor, counts[n], self)) status = EXIT_FAILURE;
+        }
+    }
+    return status;
+}
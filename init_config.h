@@ -0,0 +1,88 @@
+#ifndef INIT_CONFIG_H
+#define INIT_CONFIG_H
+
+// Compile-time feature selection for init_main.c. Every feature is on by
+// default, which is the full server build:
+//
+//   cc -O2 -o init init_main.c
+//
+// -DINIT_MINIMAL turns every feature off by default instead, for a small
+// init that still schedules by dependency, supervises, restarts with backoff,
+// handles ready=notify and watchdogs, and reloads on SIGHUP:
+//
+//   cc -Os -DINIT_MINIMAL -o init init_main.c
+//
+// Either way a single feature can be set explicitly, e.g.
+// -DINIT_MINIMAL -DINIT_CONTROL=1. Inittab options of a feature that is not
+// built in are reported and ignored like any unknown option.
+
+#ifdef INIT_MINIMAL
+#define INIT_FEATURE_DEFAULT 0
+#else
+#define INIT_FEATURE_DEFAULT 1
+#endif
+
+// One cgroup v2 group per service: memory and CPU limits, memory events and
+// PSI, killing whole process trees and telling which service an orphan was
+#ifndef INIT_CGROUPS
+#define INIT_CGROUPS INIT_FEATURE_DEFAULT
+#endif
+
+// listen= and idle=: sockets bound by init, services started on the first
+// connection
+#ifndef INIT_SOCKET_ACTIVATION
+#define INIT_SOCKET_ACTIVATION INIT_FEATURE_DEFAULT
+#endif
+
+// pin= and the @cpus and @nodes templates, from the CPU and NUMA topology
+#ifndef INIT_PLACEMENT
+#define INIT_PLACEMENT INIT_FEATURE_DEFAULT
+#endif
+
+// nice=, sched=, ioprio= and oom_score_adj=
+#ifndef INIT_PRIORITIES
+#define INIT_PRIORITIES INIT_FEATURE_DEFAULT
+#endif
+
+// The compiled inittab cached in CONFIG_CACHE; without it every load parses
+#ifndef INIT_CONFIG_CACHE
+#define INIT_CONFIG_CACHE INIT_FEATURE_DEFAULT
+#endif
+
+// INIT_LOG_FORMAT=binary
+#ifndef INIT_BINARY_LOG
+#define INIT_BINARY_LOG INIT_FEATURE_DEFAULT
+#endif
+
+// The control socket initctl talks to, and its snapshot
+#ifndef INIT_CONTROL
+#define INIT_CONTROL INIT_FEATURE_DEFAULT
+#endif
+
+// Latency histograms and initctl metrics
+#ifndef INIT_METRICS
+#define INIT_METRICS INIT_CONTROL
+#endif
+
+// The boot trace for initctl trace and critical-path
+#ifndef INIT_TRACE
+#define INIT_TRACE INIT_CONTROL
+#endif
+
+// initctl reexec
+#ifndef INIT_REEXEC
+#define INIT_REEXEC INIT_CONTROL
+#endif
+
+#if !INIT_CONTROL && (INIT_METRICS || INIT_TRACE || INIT_REEXEC)
+#error "INIT_METRICS, INIT_TRACE and INIT_REEXEC need INIT_CONTROL"
+#endif
+
+// The features of this build as a bitmask, so a compiled inittab cached by a
+// build with different options is never used
+#define INIT_FEATURES                                                                                                  \
+    (INIT_CGROUPS << 0 | INIT_SOCKET_ACTIVATION << 1 | INIT_PLACEMENT << 2 | INIT_PRIORITIES << 3 |                    \
+     INIT_CONFIG_CACHE << 4 | INIT_BINARY_LOG << 5 | INIT_CONTROL << 6 | INIT_METRICS << 7 | INIT_TRACE << 8 |         \
+     INIT_REEXEC << 9)
+
+#endif
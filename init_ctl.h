@@ -0,0 +1,139 @@
+#ifndef INIT_CTL_H
+#define INIT_CTL_H
+
+#include <stdint.h>
+
+// Control protocol shared by init_main.c and initctl.c.
+//
+// The supervisor listens on CTL_SOCKET_PATH, an AF_UNIX SOCK_SEQPACKET
+// socket, so every request and response is exactly one message. A request is
+// a CtlRequest followed by name_len bytes of service name (no terminator);
+// the answer is one CtlResponse carrying the same tag. A client may keep the
+// connection open and pipeline requests; they are answered in order.
+//
+// CTL_SNAPSHOT answers with a sealed, read-only memfd passed as SCM_RIGHTS
+// alongside the response: a CtlSnapshotHeader, then one CtlServiceRecord per
+// service, then the NUL-terminated names they point at. A collector gets the
+// whole table with one recvmsg() and one mmap(), whatever its size.
+// CTL_METRICS answers the same way with a memfd of Prometheus text, and
+// CTL_TRACE with the boot trace: a CtlTraceHeader, CtlTraceEvents in the
+// order they happened, then the names they point at.
+
+#define CTL_SOCKET_PATH "/run/initctl.sock"
+#define CTL_NAME_MAX 255
+#define MAX_RUNLEVELS 5 // CTL_SWITCH takes 0 to MAX_RUNLEVELS - 1
+
+typedef enum {
+    STATE_WAITING,    // Loaded, dependencies not running yet
+    STATE_LISTENING,  // Sockets bound, started on the first connection; counts as running for dependents
+    STATE_STARTING,   // Spawned, waiting for a ready=notify service's READY=1
+    STATE_RUNNING,    // Ready; dependents may start
+    STATE_STOPPING,   // Signalled on purpose, not reaped yet
+    STATE_RESTARTING, // As stopping, but started again once reaped
+    STATE_STOPPED,
+    STATE_CRASHED,    // Exited on its own, waiting to be restarted
+    STATE_FAILED,     // Can never start (dependency cycle, unknown dependency or crash loop)
+    STATE_COUNT,
+} ServiceState;
+
+static const char *const state_names[] = {"waiting", "listening", "starting", "running", "stopping",
+                                          "restarting", "stopped", "crashed", "failed"};
+
+typedef enum {
+    CTL_STATUS,
+    CTL_START,
+    CTL_STOP,
+    CTL_RESTART,
+    CTL_SWITCH,   // Takes arg, no name
+    CTL_SNAPSHOT, // No name; answered with a memfd
+    CTL_METRICS,  // No name; answered with a memfd
+    CTL_TRACE,    // No name; answered with a memfd
+    CTL_REEXEC,   // No name; the supervisor re-executes itself once it has answered
+    CTL_OP_COUNT,
+} CtlOp;
+
+typedef enum {
+    CTL_OK,
+    CTL_ERR_BAD_REQUEST,
+    CTL_ERR_UNKNOWN_SERVICE,
+    CTL_ERR_BAD_RUNLEVEL,
+    CTL_ERR_SHUTTING_DOWN,
+    CTL_ERR_SNAPSHOT_FAILED,
+    CTL_ERR_UNSUPPORTED, // The supervisor was built without the feature, see init_config.h
+    CTL_ERR_COUNT,
+} CtlStatus;
+
+static const char *const ctl_status_names[] = {"ok", "bad request", "unknown service", "invalid runlevel",
+                                               "shutting down", "snapshot failed", "not supported by this build"};
+
+typedef struct {
+    uint32_t tag;     // Chosen by the client, echoed in the response
+    uint8_t op;       // CtlOp
+    uint8_t name_len;
+    uint16_t arg;     // Runlevel for CTL_SWITCH
+} CtlRequest;
+
+typedef struct {
+    uint32_t tag;
+    uint8_t status;   // CtlStatus
+    uint8_t state;    // ServiceState after the request
+    uint16_t restart_count;
+    int32_t pid;      // 0 if not running
+    uint32_t runlevel; // Current runlevel
+} CtlResponse;
+
+#define CTL_SNAPSHOT_MAGIC "INITSNP2" // 2: 64-bit uptime
+
+typedef struct {
+    char magic[8];         // CTL_SNAPSHOT_MAGIC
+    uint64_t timestamp_ns; // CLOCK_REALTIME when taken
+    uint32_t count;        // Records following the header
+    uint32_t runlevel;
+    uint32_t strings;      // Offset of the name section from the start of the snapshot
+    uint32_t size;         // Total bytes
+} CtlSnapshotHeader;
+
+typedef struct {
+    uint32_t name;         // Offset of the service's command within the name section
+    int32_t pid;           // 0 if not running
+    uint64_t uptime_ms;    // Since the last start, 0 if not running
+    uint8_t state;         // ServiceState
+    uint8_t runlevel;
+    uint16_t restart_count;
+    int32_t memory_limit;  // Bytes, 0 for none
+    int32_t cpu_limit;     // Percent of one CPU, 0 for none
+    uint32_t reserved;
+} CtlServiceRecord;
+
+#define CTL_TRACE_MAGIC "INITTRC1"
+
+typedef enum {
+    TRACE_CONFIG_LOADED, // arg = us spent loading the inittab
+    TRACE_SPAWN,         // clone() called
+    TRACE_EXEC,          // The child has exec'd, or failed to with errno arg
+    TRACE_READY,         // Counts as running for its dependents
+    TRACE_UNBLOCKED,     // Its last missing dependency, cause, came up
+    TRACE_EXIT,          // Reaped, arg = wait status
+    TRACE_EVENT_COUNT,
+} TraceEventType;
+
+typedef struct {
+    char magic[8];      // CTL_TRACE_MAGIC
+    uint64_t start_us;  // CLOCK_MONOTONIC when the supervisor started
+    uint32_t count;     // Events following the header
+    uint32_t dropped;   // Events not recorded because the trace was full
+    uint32_t strings;   // Offset of the name section from the start of the trace
+    uint32_t size;      // Total bytes
+} CtlTraceHeader;
+
+typedef struct {
+    uint64_t time_us;   // CLOCK_MONOTONIC, so comparable across boots of one machine
+    uint32_t service;   // Offset of the service's name within the name section, 0 for none
+    uint32_t cause;     // Offset of the dependency's name for TRACE_UNBLOCKED, else 0
+    int32_t pid;
+    int32_t arg;
+    uint8_t type;       // TraceEventType
+    uint8_t reserved[7];
+} CtlTraceEvent;
+
+#endif
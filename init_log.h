@@ -0,0 +1,166 @@
+#ifndef INIT_LOG_H
+#define INIT_LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Binary log format shared by init_main.c and init_logdump.c.
+//
+// A binary log file starts with LOG_BINARY_MAGIC and is followed by records.
+// Each record is a fixed LogRecord, then text_len bytes of text padded with
+// zeros to a multiple of 8. Service names are not repeated in every record:
+// an EV_SERVICE_NAME record maps a service ID to its name whenever the table
+// is loaded and at the start of every rotated file.
+
+#define LOG_BINARY_MAGIC "INITLOG1"
+#define LOG_BINARY_MAGIC_LEN 8
+
+typedef enum {
+    LOG_INFO,
+    LOG_WARNING,
+    LOG_ERROR,
+} LogLevel;
+
+static const char *const log_level_names[] = {"INFO", "WARNING", "ERROR"};
+
+typedef enum {
+    EV_MESSAGE,            // Free-form text
+    EV_SERVICE_NAME,       // Text is the name of the service
+    EV_STARTED,            // args[0] = runlevel
+    EV_EXITED,             // args[0] = wait status
+    EV_RESTARTING,
+    EV_ALREADY_RUNNING,
+    EV_DEPS_UNSATISFIED,
+    EV_UNKNOWN_DEPENDENCY, // Text is the missing dependency
+    EV_DEPENDENCY_CYCLE,
+    EV_DUPLICATE_SERVICE,  // Text is the duplicated command
+    EV_RUNLEVEL_SWITCH,    // args[0] = old runlevel, args[1] = new runlevel
+    EV_EXEC_FAILED,        // args[0] = errno
+    EV_MEMORY_HIGH,        // args[0] = memory.events "high" count
+    EV_MEMORY_MAX,         // args[0] = memory.events "max" count
+    EV_OOM_KILL,           // args[0] = memory.events "oom_kill" count
+    EV_MEMORY_PRESSURE,    // args[0] = memory.current as a percentage of the limit
+    EV_MEMORY_RESTART,     // args[0] = memory.current as a percentage of the limit
+    EV_RESTART_SCHEDULED,  // args[0] = delay in ms, args[1] = restarts in the current window
+    EV_CRASH_LOOP,         // args[0] = restarts, args[1] = window in seconds
+    EV_SERVICE_REMOVED,
+    EV_SERVICE_CHANGED,    // Text is what changed
+    EV_STOP_TIMEOUT,       // args[0] = ms since SIGTERM
+    EV_STOP_SUMMARY,       // args[0] = ms from SIGTERM to exit, args[1] = 1 if it had to be killed
+    EV_SHUTDOWN_COMPLETE,  // args[0] = ms the whole shutdown took
+    EV_READY,              // args[0] = ms from spawn to READY=1
+    EV_START_TIMEOUT,      // args[0] = timeout in ms
+    EV_WATCHDOG_TIMEOUT,   // args[0] = watchdog interval in ms
+    EV_BAD_OPTION,         // Text is the option
+    EV_LISTENING,          // args[0] = number of sockets
+    EV_SOCKET_ACTIVATED,
+    EV_LISTEN_FAILED,      // args[0] = errno, text is the address
+    EV_IDLE_STOP,          // args[0] = seconds without activity
+    EV_ORPHAN_REAPED,      // args[0] = wait status; service is the cgroup it was in, -1 if none
+    EV_REEXEC,             // args[0] = services handed over, text is the binary
+    EV_REEXEC_FAILED,      // args[0] = errno, text is the binary
+    EV_STATE_RESTORED,     // args[0] = services, args[1] = ms since the old supervisor wrote its state
+    EV_STATE_REJECTED,     // args[0] = processes of the old supervisor being stopped
+    EV_COUNT,
+} LogEvent;
+
+typedef struct {
+    uint64_t timestamp_ns; // CLOCK_REALTIME
+    uint32_t sequence;     // Per-supervisor record counter, to spot dropped records
+    uint8_t level;         // LogLevel
+    uint8_t event;         // LogEvent
+    uint16_t text_len;
+    int32_t service;       // Service ID, -1 if none
+    int32_t pid;
+    int32_t args[2];
+} LogRecord;
+
+// Render the text of a record exactly as the text log would show it, without
+// the "[LEVEL] " prefix and newline.
+static inline int format_log_record(char *buf, size_t size, const LogRecord *rec, const char *service,
+                                    const char *text) {
+    switch (rec->event) {
+    case EV_SERVICE_NAME:
+        return snprintf(buf, size, "Service %d is %s", rec->service, text);
+    case EV_STARTED:
+        return snprintf(buf, size, "Started process: %s with PID: %d for runlevel: %d", service, rec->pid, rec->args[0]);
+    case EV_EXITED:
+        return snprintf(buf, size, "Process %s (PID %d) finished", service, rec->pid);
+    case EV_RESTARTING:
+        return snprintf(buf, size, "Restarting process: %s", service);
+    case EV_ALREADY_RUNNING:
+        return snprintf(buf, size, "Not starting %s: PID %d is still running", service, rec->pid);
+    case EV_DEPS_UNSATISFIED:
+        return snprintf(buf, size, "Cannot start %s: dependencies not satisfied", service);
+    case EV_UNKNOWN_DEPENDENCY:
+        return snprintf(buf, size, "Service %s depends on unknown service %s", service, text);
+    case EV_DEPENDENCY_CYCLE:
+        return snprintf(buf, size, "Service %s is part of a dependency cycle", service);
+    case EV_DUPLICATE_SERVICE:
+        return snprintf(buf, size, "Ignoring duplicate entry for %s", text);
+    case EV_RUNLEVEL_SWITCH:
+        return snprintf(buf, size, "Switching from runlevel %d to %d", rec->args[0], rec->args[1]);
+    case EV_EXEC_FAILED:
+        return snprintf(buf, size, "Failed to exec %s: %s", service, strerror(rec->args[0]));
+    case EV_MEMORY_HIGH:
+        return snprintf(buf, size, "Service %s is over memory.high and being throttled (%d times)", service, rec->args[0]);
+    case EV_MEMORY_MAX:
+        return snprintf(buf, size, "Service %s hit its memory limit (%d times)", service, rec->args[0]);
+    case EV_OOM_KILL:
+        return snprintf(buf, size, "OOM killer killed a process of %s (%d kills)", service, rec->args[0]);
+    case EV_MEMORY_PRESSURE:
+        return snprintf(buf, size, "Service %s is stalling on memory at %d%% of its limit", service, rec->args[0]);
+    case EV_MEMORY_RESTART:
+        return snprintf(buf, size, "Restarting %s before it is OOM killed: memory at %d%% of its limit", service,
+                        rec->args[0]);
+    case EV_RESTART_SCHEDULED:
+        return snprintf(buf, size, "Restarting %s in %d ms (restart %d)", service, rec->args[0], rec->args[1]);
+    case EV_CRASH_LOOP:
+        return snprintf(buf, size, "Service %s crashed again after %d restarts in %d seconds, giving up", service,
+                        rec->args[0], rec->args[1]);
+    case EV_SERVICE_REMOVED:
+        return snprintf(buf, size, "Stopping %s: not configured for this runlevel any more", service);
+    case EV_SERVICE_CHANGED:
+        return snprintf(buf, size, "Service %s changed: %s", service, text);
+    case EV_STOP_TIMEOUT:
+        return snprintf(buf, size, "Service %s did not stop within %d ms, sending SIGKILL", service, rec->args[0]);
+    case EV_STOP_SUMMARY:
+        return snprintf(buf, size, "Stopped %s in %d ms%s", service, rec->args[0], rec->args[1] ? " (killed)" : "");
+    case EV_SHUTDOWN_COMPLETE:
+        return snprintf(buf, size, "All processes terminated in %d ms. Exiting init.", rec->args[0]);
+    case EV_READY:
+        return snprintf(buf, size, "Service %s is ready after %d ms", service, rec->args[0]);
+    case EV_START_TIMEOUT:
+        return snprintf(buf, size, "Service %s did not report ready within %d ms", service, rec->args[0]);
+    case EV_WATCHDOG_TIMEOUT:
+        return snprintf(buf, size, "Service %s missed its %d ms watchdog", service, rec->args[0]);
+    case EV_BAD_OPTION:
+        return snprintf(buf, size, "Service %s: ignoring option %s", service, text);
+    case EV_LISTENING:
+        return snprintf(buf, size, "Listening for %s on %d sockets", service, rec->args[0]);
+    case EV_SOCKET_ACTIVATED:
+        return snprintf(buf, size, "Connection for %s, starting it", service);
+    case EV_LISTEN_FAILED:
+        return snprintf(buf, size, "Service %s cannot listen on %s: %s", service, text, strerror(rec->args[0]));
+    case EV_IDLE_STOP:
+        return snprintf(buf, size, "Stopping %s after %d s idle, listening again", service, rec->args[0]);
+    case EV_ORPHAN_REAPED:
+        if (rec->service < 0) return snprintf(buf, size, "Reaped orphan PID %d", rec->pid);
+        return snprintf(buf, size, "Reaped orphan PID %d of %s", rec->pid, service);
+    case EV_REEXEC:
+        return snprintf(buf, size, "Re-executing %s with %d services", text, rec->args[0]);
+    case EV_REEXEC_FAILED:
+        return snprintf(buf, size, "Cannot re-execute %s: %s", text, strerror(rec->args[0]));
+    case EV_STATE_RESTORED:
+        return snprintf(buf, size, "Restored %d services, %d ms after the previous supervisor saved them", rec->args[0],
+                        rec->args[1]);
+    case EV_STATE_REJECTED:
+        return snprintf(buf, size, "Cannot restore the previous supervisor's state; stopping its %d processes and "
+                        "starting services afresh", rec->args[0]);
+    default:
+        return snprintf(buf, size, "%s", text);
+    }
+}
+
+#endif
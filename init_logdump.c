@@ -0,0 +1,161 @@
+// Decoder for the binary log written by init_main.c with
+// INIT_LOG_FORMAT=binary.
+//
+//   cc -O2 -o init_logdump init_logdump.c
+//   init_logdump [-j] [file...]
+//
+// By default each record is printed as the text log line init would have
+// written, prefixed with its UTC timestamp. -j prints one JSON object per
+// record instead, for feeding log pipelines. Reads stdin if no file is given.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "init_log.h"
+
+static const char *const log_event_names[] = {
+    "message", "service_name", "started", "exited", "restarting", "already_running",
+    "deps_unsatisfied", "unknown_dependency", "dependency_cycle", "duplicate_service", "runlevel_switch",
+    "exec_failed", "memory_high", "memory_max", "oom_kill", "memory_pressure", "memory_restart",
+    "restart_scheduled", "crash_loop", "service_removed", "service_changed",
+    "stop_timeout", "stop_summary", "shutdown_complete", "ready", "start_timeout", "watchdog_timeout", "bad_option",
+    "listening", "socket_activated", "listen_failed", "idle_stop", "orphan_reaped",
+    "reexec", "reexec_failed", "state_restored", "state_rejected",
+};
+
+char **service_names;
+int service_names_count = 0;
+
+const char *service_name(int id) {
+    if (id >= 0 && id < service_names_count && service_names[id]) {
+        return service_names[id];
+    }
+    return "?";
+}
+
+void set_service_name(int id, const char *name) {
+    if (id < 0) return;
+    if (id >= service_names_count) {
+        int count = id + 1;
+        service_names = realloc(service_names, count * sizeof(char *));
+        if (!service_names) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        memset(service_names + service_names_count, 0, (count - service_names_count) * sizeof(char *));
+        service_names_count = count;
+    }
+    free(service_names[id]);
+    service_names[id] = strdup(name);
+}
+
+void print_json_string(const char *s) {
+    putchar('"');
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            printf("\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            printf("\\u%04x", *s);
+        } else {
+            putchar(*s);
+        }
+    }
+    putchar('"');
+}
+
+void print_record(const LogRecord *rec, const char *text, bool json) {
+    const char *level = rec->level <= LOG_ERROR ? log_level_names[rec->level] : "?";
+    const char *event = rec->event < EV_COUNT ? log_event_names[rec->event] : "unknown";
+    char line[1024];
+    format_log_record(line, sizeof(line), rec, service_name(rec->service), text);
+
+    if (json) {
+        printf("{\"ts_ns\":%llu,\"seq\":%u,\"level\":\"%s\",\"event\":\"%s\",\"service\":",
+               (unsigned long long)rec->timestamp_ns, rec->sequence, level, event);
+        if (rec->service >= 0) {
+            print_json_string(service_name(rec->service));
+        } else {
+            printf("null");
+        }
+        printf(",\"pid\":%d,\"args\":[%d,%d],\"text\":", rec->pid, rec->args[0], rec->args[1]);
+        print_json_string(line);
+        printf("}\n");
+        return;
+    }
+
+    time_t secs = rec->timestamp_ns / 1000000000u;
+    struct tm tm;
+    char stamp[32];
+    gmtime_r(&secs, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    printf("%s.%06uZ [%s] %s\n", stamp, (unsigned)(rec->timestamp_ns % 1000000000u / 1000), level, line);
+}
+
+int dump(FILE *in, const char *path, bool json) {
+    char magic[LOG_BINARY_MAGIC_LEN];
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, LOG_BINARY_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s: not a binary init log\n", path);
+        return -1;
+    }
+
+    uint32_t expected = 0;
+    bool first = true;
+    LogRecord rec;
+    while (fread(&rec, sizeof(rec), 1, in) == 1) {
+        char text[65536 + 8];
+        uint32_t padded = (sizeof(LogRecord) + rec.text_len + 7) / 8 * 8 - sizeof(LogRecord);
+        if (fread(text, 1, padded, in) != padded) {
+            fprintf(stderr, "%s: truncated record\n", path);
+            return -1;
+        }
+        text[rec.text_len] = '\0';
+
+        if (!first && rec.sequence != expected && rec.sequence != 0) { // 0 means init restarted
+            fprintf(stderr, "%s: %u records missing before sequence %u\n", path, rec.sequence - expected, rec.sequence);
+        }
+        first = false;
+        expected = rec.sequence + 1;
+
+        if (rec.event == EV_SERVICE_NAME) {
+            set_service_name(rec.service, text);
+        }
+        print_record(&rec, text, json);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    bool json = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "j")) != -1) {
+        if (opt == 'j') {
+            json = true;
+        } else {
+            fprintf(stderr, "Usage: %s [-j] [file...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind == argc) {
+        return dump(stdin, "<stdin>", json) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    for (int i = optind; i < argc; i++) {
+        FILE *in = fopen(argv[i], "rb");
+        if (!in) {
+            perror(argv[i]);
+            status = EXIT_FAILURE;
+            continue;
+        }
+        if (dump(in, argv[i], json) != 0) {
+            status = EXIT_FAILURE;
+        }
+        fclose(in);
+    }
+    return status;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -6,160 +7,3964 @@
 #include <signal.h>
 #include <string.h>
 #include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+#include <dirent.h>
+
+#include "init_config.h"
+#include "init_ctl.h"
+#include "init_log.h"
+
+#if INIT_CGROUPS
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <linux/sched.h>
+#endif
+#if INIT_SOCKET_ACTIVATION
+#include <netinet/in.h>
+#include <netdb.h>
+#endif
+#if INIT_PLACEMENT
+#include <linux/mempolicy.h>
+#endif
+#if INIT_PRIORITIES
+#include <linux/ioprio.h>
+#include <sys/resource.h>
+#endif
 
 #define SHELL "/bin/sh"
-#define MAX_PROCESSES 10
 #define CONFIG_FILE "/etc/inittab"
+#define CONFIG_CACHE_DIR "/var/lib/init"
+#define CONFIG_CACHE CONFIG_CACHE_DIR "/inittab.cache" // Compiled inittab, see load_processes()
 #define LOG_FILE "/var/log/init.log"
-#define MAX_RUNLEVELS 5
+#define LOG_BINARY_FILE "/var/log/init.log.bin" // Used when INIT_LOG_FORMAT=binary
 #define HEALTH_CHECK_INTERVAL 5 // Check every 5 seconds
+#define MAX_LOG_SIZE (1024 * 1024) // 1 MB
+#define LOG_RING_SIZE (64 * 1024) // Must be a power of two
+#define RESTART_DELAY_BASE_MS 100 // First restart delay, doubled on every further crash
+#define RESTART_DELAY_MAX_MS 30000 // Default cap on the delay, INIT_RESTART_DELAY_MAX overrides
+#define RESTART_LIMIT 5            // Default crashes per window before failing, INIT_RESTART_LIMIT overrides
+#define RESTART_WINDOW 60          // Crash-loop window in seconds
+#define STOP_TIMEOUT_MS 10000      // Default SIGTERM to SIGKILL deadline, INIT_STOP_TIMEOUT overrides
+#define START_TIMEOUT_MS 30000     // How long a ready=notify service has to send READY=1
+#define PASSED_FD_START 3          // A service's listen sockets start here, then comes its notify socket
+#define LISTEN_MAX 4               // listen= sockets per service
+#define MAX_INSTANCES 1024         // Per template
+#define MAX_NUMA_NODES 64
+#define IDLE_CPU_US 500            // CPU time per health check below which an idle= service is not busy
+#define REAP_BATCH 64              // Exits collected before any of them is handled
+#define NOTIFY_BATCH 16            // Notify datagrams taken per wakeup, so no service can hog the loop
+#define NOTIFY_MESSAGE_MAX 256
+#define CTL_BATCH 64 // Control requests answered per client wakeup
+#define TRACE_MAX 65536 // Trace events kept; the boot is what matters, so later ones are only counted
+#define HISTOGRAM_BUCKETS 25 // Powers of two from 1us to 2^23us (8.4s), then +Inf
+#define TABLE_INITIAL_CAPACITY 16
+#define SPAWN_STACK_SIZE (64 * 1024)
+#define CGROUP_MOUNT "/sys/fs/cgroup"
+#define CGROUP_ROOT CGROUP_MOUNT "/init" // Holds one cgroup v2 group per service
+#define CGROUP_TEST_ROOT CGROUP_MOUNT "/init.%d" // CGROUP_ROOT under INIT_ROOT, named by our PID
+#define CPU_PERIOD_US 100000
+#define MEMORY_HIGH_PERCENT 90    // memory.high, where the kernel starts throttling, as % of memory_limit
+#define MEMORY_RESTART_PERCENT 95 // Restart a service stalling on memory above this % of memory_limit
+#define MEMORY_PSI_TRIGGER "some 150000 1000000" // 150ms of memory stall within 1s
+
+// Hot per-service fields, the only part the reaper and health sweeps scan.
+// Eight bytes each, so one cache line covers eight services.
+typedef struct {
+    pid_t pid;
+    uint8_t state; // ServiceState
+    uint8_t runlevel;
+    uint16_t restart_count; // Restarts in the current crash-loop window
+} Process;
+
+// Cold per-service fields, read when a service is started or reported on.
+// Strings are offsets into the interned string arena.
+typedef enum {
+    PIN_NONE,
+    PIN_CPU,  // pin=cpu: instance k runs on the k-th CPU we may use
+    PIN_NODE, // pin=node: instance k runs on the CPUs and memory of the k-th NUMA node
+} Pinning;
+
+typedef struct {
+    uint32_t command;
+    uint32_t path;         // What is exec'd: the command, or an instance's template path
+    uint16_t instance;     // Index of a template instance, passed as argv[1] and INIT_INSTANCE
+    uint16_t instances;    // Instances of its template, 0 for a plain service
+    uint8_t pin;           // Pinning
+    uint8_t sched_policy;  // SCHED_*, SCHED_OTHER to inherit ours
+    uint8_t sched_priority; // For SCHED_FIFO and SCHED_RR
+    int8_t nice;           // 0 to inherit ours
+    uint16_t ioprio;       // IOPRIO_PRIO_VALUE(), 0 to inherit ours
+    int16_t oom_score_adj; // 0 to inherit ours
+    uint32_t dependencies; // Comma-separated service commands, as written in the inittab
+    uint32_t dep_start;    // This service's dependency IDs are dep_ids[dep_start..+dep_count)
+    uint32_t dep_count;
+    uint32_t dependent_start; // IDs of services depending on this one, in dependent_ids
+    uint32_t dependent_count;
+    uint32_t deps_down;       // Dependencies not currently running; startable at 0
+    int notify_fd;    // Our end of the service's notify socket, -1 when not running
+    int memory_limit; // Memory limit in bytes
+    int cpu_limit;    // CPU limit percentage
+    bool notify;          // ready=notify: running only once it sends READY=1
+    uint32_t watchdog_ms; // watchdog=SECONDS: WATCHDOG=1 must arrive this often, 0 for none
+    uint64_t start_time;  // CLOCK_MONOTONIC us at last start
+    time_t crash_window_start; // CLOCK_MONOTONIC seconds of the first crash counted in restart_count
+    uint64_t restart_at;       // CLOCK_MONOTONIC ms of the pending restart, 0 if none
+    uint64_t stop_started;     // CLOCK_MONOTONIC ms SIGTERM was sent, 0 if not stopping
+    uint64_t kill_at;          // CLOCK_MONOTONIC ms of the SIGKILL escalation, 0 if none
+    uint32_t stop_ms;          // How long the last stop took
+    bool stop_killed;          // Whether it needed SIGKILL
+    uint32_t restarts_total;   // Every restart since the service was first loaded
+    uint64_t alive_at;         // CLOCK_MONOTONIC ms by which READY=1 or WATCHDOG=1 is due, 0 if none
+    uint64_t alive_timer;      // Due time of the heap entry watching alive_at, 0 if none
+    uint32_t listen;           // listen= addresses, space-separated, "" for a service started eagerly
+    int listen_fds[LISTEN_MAX]; // Bound sockets, kept for the service's whole life and passed to every instance
+    uint8_t listen_count;
+    bool listening;            // listen_fds are registered with epoll
+    uint32_t idle_ms;          // idle=SECONDS: stop after this long without activity, 0 to keep it running
+    uint64_t active_at;        // CLOCK_MONOTONIC ms of the last connection or busy health check
+    uint32_t cpu_usage;        // Last seen CPU time in us, low 32 bits
+    bool cpu_sampled;          // cpu_usage is from the current run
+    bool idle_stopping;        // Being stopped for idleness; listens again once reaped
+    int cpu_stat_fd;           // cpu.stat of an idle= service, -1 if none
+    int cgroup_fd;       // The service's own cgroup directory, -1 without cgroups
+    int cgroup_procs_fd; // Its cgroup.procs, kept open for the spawn path
+    int memory_events_fd;   // memory.events, watched for EPOLLPRI
+    int cgroup_events_fd;   // cgroup.events, watched for EPOLLPRI to see the last process leave
+    bool start_when_empty;  // Start once the leftovers of its last run have left its cgroup
+    int memory_pressure_fd; // memory.pressure with a PSI trigger armed, -1 without a limit
+    uint32_t memory_high;   // Last seen memory.events counters
+    uint32_t memory_max;
+    uint32_t memory_oom_kill;
+} ProcessConfig;
+
+// The service table has exactly one owner: the event loop. Signals, timers
+// and requests are all handled on that thread, so every supervision decision
+// reads live state and nothing works from a forked copy of the table.
+// processes[i] and process_config[i] describe the same service.
+Process *processes;
+ProcessConfig *process_config;
+int process_count = 0;
+int process_capacity = 0;
+int current_runlevel = 0;
+int named_count = 0; // Slots from the inittab; those after it are retired services still stopping
+bool shutting_down = false;
+uint64_t shutdown_started = 0;
+int *boot_order; // Topological start order of processes[]
+int boot_count = 0;
+
+// A service's ID is its index in the table. service_ids maps a command to its
+// ID (open addressing, -1 marks a free slot), and dependencies are resolved
+// to ID lists in dep_ids once when the inittab is loaded. dependent_ids holds
+// the same edges reversed, grouped by the service depended on.
+int *service_ids;
+uint32_t service_ids_capacity = 0;
+// Retired services by command, the same way. Their processes are still in
+// cgroups named after commands that service_ids no longer maps.
+int *retired_ids;
+uint32_t retired_ids_capacity = 0;
+int *dep_ids;
+uint32_t dep_ids_count = 0;
+uint32_t dep_ids_capacity = 0;
+int *dependent_ids;
+int *config_deps; // Dependencies of the services just loaded, see load_image()
+uint32_t config_deps_count = 0;
+uint32_t config_deps_capacity = 0;
+
+// Every command and dependency string lives once in string_arena; offset 0 is
+// the empty string. intern_slots is an open-addressed set of arena offsets.
+char *string_arena;
+uint32_t arena_len = 0;
+uint32_t arena_capacity = 0;
+uint32_t *intern_slots;
+uint32_t intern_capacity = 0;
+uint32_t intern_count = 0;
+
+// pid -> table slot for every live child, so the reaper finds a service in
+// constant time. Open addressing with linear probing; pid 0 marks a free slot.
+typedef struct {
+    pid_t pid;
+    int slot;
+} PidEntry;
+
+PidEntry *pid_index;
+uint32_t pid_index_capacity = 0;
+uint32_t pid_index_count = 0;
+
+void log_message(LogLevel level, const char *message);
+void log_flush();
+
+// Every fd the supervisor waits on is registered with epoll_fd, tagged with
+// what it is and which service it belongs to.
+typedef enum {
+    EVENT_SIGNAL,
+    EVENT_TIMER,
+    EVENT_SERVICE_TIMER,
+    EVENT_MEMORY_EVENTS,
+    EVENT_CGROUP_EVENTS,
+    EVENT_MEMORY_PRESSURE,
+    EVENT_NOTIFY,
+    EVENT_LISTEN,         // A listen= socket of a service waiting for its first connection
+    EVENT_CONTROL,        // The listening control socket
+    EVENT_CONTROL_CLIENT, // A connected client; the ID is its fd
+} EventSource;
+
+int epoll_fd = -1;
+int signal_fd = -1;
+int timer_fd = -1;
+int service_timer_fd = -1;
+int control_fd = -1;
+
+void epoll_watch(int op, int fd, uint32_t events, EventSource source, int service) {
+    struct epoll_event ev = {.events = events};
+    ev.data.u64 = (uint64_t)source << 32 | (uint32_t)service;
+    if (epoll_ctl(epoll_fd, op, fd, &ev) < 0) {
+        perror("epoll_ctl");
+    }
+}
+
+void watch_fd(int fd, uint32_t events, EventSource source, int service) {
+    epoll_watch(EPOLL_CTL_ADD, fd, events, source, service);
+}
+
+// Retag a watched fd after its service moved to a new slot
+void rewatch_fd(int fd, uint32_t events, EventSource source, int service) {
+    epoll_watch(EPOLL_CTL_MOD, fd, events, source, service);
+}
+
+void *xrealloc(void *ptr, size_t size) {
+    void *p = realloc(ptr, size);
+    if (!p) {
+        log_message(LOG_ERROR, "Out of memory");
+        log_flush();
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+time_t monotonic_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+uint64_t monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t monotonic_ms() {
+    return monotonic_us() / 1000;
+}
+
+// Latency histograms for the supervisor's hot paths, exported as Prometheus
+// text over the control socket. Bucket k counts samples of at most 2^k us, so
+// recording one is a clz and two increments.
+typedef struct {
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum_us;
+} Histogram;
+
+Histogram spawn_latency; // clone() until the child has exec'd
+Histogram ready_latency; // clone() until running: at once, or on READY=1
+Histogram reap_lag;      // Wakeup reporting SIGCHLD until waitpid() collects the child
+Histogram flush_latency; // One log_flush() that had something to write
+uint64_t wakeup_us;      // When epoll_wait() last returned
+
+void histogram_record(Histogram *h, uint64_t us) {
+#if INIT_METRICS
+    int k = us <= 1 ? 0 : 64 - __builtin_clzll(us - 1);
+    h->buckets[k < HISTOGRAM_BUCKETS ? k : HISTOGRAM_BUCKETS - 1]++;
+    h->count++;
+    h->sum_us += us;
+#else
+    (void)h;
+    (void)us;
+#endif
+}
+
+uint32_t hash_string(const char *s) {
+    uint32_t h = 2166136261u; // FNV-1a
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+uint64_t hash_bytes(const char *s, size_t len) {
+    uint64_t h = 14695981039346656037u; // 64-bit FNV-1a
+    for (size_t k = 0; k < len; k++) {
+        h ^= (unsigned char)s[k];
+        h *= 1099511628211u;
+    }
+    return h;
+}
+
+const char *arena_str(uint32_t offset) {
+    return string_arena + offset;
+}
+
+void grow_intern_slots() {
+    uint32_t old_capacity = intern_capacity;
+    uint32_t *old_slots = intern_slots;
+    intern_capacity = old_capacity ? old_capacity * 2 : 64;
+    intern_slots = calloc(intern_capacity, sizeof(uint32_t));
+    if (!intern_slots) {
+        log_message(LOG_ERROR, "Out of memory");
+        log_flush();
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i]) {
+            uint32_t h = hash_string(arena_str(old_slots[i])) & (intern_capacity - 1);
+            while (intern_slots[h]) h = (h + 1) & (intern_capacity - 1);
+            intern_slots[h] = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+// Return the arena offset of s, copying it in only the first time it is seen.
+uint32_t intern_string(const char *s) {
+    if (arena_capacity == 0) {
+        arena_capacity = 4096;
+        string_arena = xrealloc(NULL, arena_capacity);
+        string_arena[0] = '\0';
+        arena_len = 1;
+    }
+    if (*s == '\0') return 0;
+    if ((intern_count + 1) * 2 > intern_capacity) grow_intern_slots();
+
+    uint32_t mask = intern_capacity - 1;
+    uint32_t h = hash_string(s) & mask;
+    while (intern_slots[h]) {
+        if (strcmp(arena_str(intern_slots[h]), s) == 0) {
+            return intern_slots[h];
+        }
+        h = (h + 1) & mask;
+    }
+
+    uint32_t len = strlen(s) + 1;
+    while (arena_len + len > arena_capacity) {
+        arena_capacity *= 2;
+        string_arena = xrealloc(string_arena, arena_capacity);
+    }
+    uint32_t offset = arena_len;
+    memcpy(string_arena + offset, s, len);
+    arena_len += len;
+    intern_slots[h] = offset;
+    intern_count++;
+    return offset;
+}
+
+const char *service_command(int i) {
+    return arena_str(process_config[i].command);
+}
+
+// Monotonic timeline of the boot, and of whatever follows until TRACE_MAX
+// events, for initctl trace and critical-path. Services are recorded by
+// their command's arena offset, which stays valid since the arena only grows.
+CtlTraceEvent *trace_events;
+uint32_t trace_count = 0;
+uint32_t trace_capacity = 0;
+uint32_t trace_dropped = 0;
+uint64_t trace_start_us;
+
+void trace_event(TraceEventType type, uint64_t time_us, int i, pid_t pid, int arg, int cause) {
+#if INIT_TRACE
+    if (trace_count == TRACE_MAX) {
+        trace_dropped++;
+        return;
+    }
+    if (trace_count == trace_capacity) {
+        trace_capacity = trace_capacity ? trace_capacity * 2 : 256;
+        trace_events = xrealloc(trace_events, trace_capacity * sizeof(CtlTraceEvent));
+    }
+    trace_events[trace_count++] = (CtlTraceEvent){time_us, i >= 0 ? process_config[i].command : 0,
+                                                  cause >= 0 ? process_config[cause].command : 0, pid, arg, type, {0}};
+#else
+    (void)type, (void)time_us, (void)i, (void)pid, (void)arg, (void)cause;
+#endif
+}
+
+int find_id(const int *ids, uint32_t capacity, const char *name) {
+    if (capacity == 0) return -1;
+    uint32_t mask = capacity - 1;
+    for (uint32_t h = hash_string(name) & mask; ids[h] >= 0; h = (h + 1) & mask) {
+        if (strcmp(service_command(ids[h]), name) == 0) {
+            return ids[h];
+        }
+    }
+    return -1;
+}
+
+int find_service(const char *name) {
+    return find_id(service_ids, service_ids_capacity, name);
+}
+
+// A retired service with this command. The same command can be retired more
+// than once, e.g. dropped again while still stopping; any of them will do.
+int find_retired(const char *name) {
+    return find_id(retired_ids, retired_ids_capacity, name);
+}
+
+void rebuild_service_ids(uint32_t capacity) {
+    free(service_ids);
+    service_ids_capacity = capacity;
+    service_ids = xrealloc(NULL, capacity * sizeof(int));
+    memset(service_ids, 0xff, capacity * sizeof(int)); // All -1
+}
+
+// Make service i findable by its command. Fails if the name is already taken.
+bool register_service(int i) {
+    if (((uint32_t)i + 1) * 2 > service_ids_capacity) {
+        rebuild_service_ids(service_ids_capacity ? service_ids_capacity * 2 : 64);
+        for (int j = 0; j < i; j++) {
+            register_service(j);
+        }
+    }
+    const char *name = service_command(i);
+    uint32_t mask = service_ids_capacity - 1;
+    uint32_t h = hash_string(name) & mask;
+    while (service_ids[h] >= 0) {
+        if (strcmp(service_command(service_ids[h]), name) == 0) {
+            return false;
+        }
+        h = (h + 1) & mask;
+    }
+    service_ids[h] = i;
+    return true;
+}
+
+// Make retired service i findable by its command
+void register_retired(int i) {
+    if (((uint32_t)(i - named_count) + 1) * 2 > retired_ids_capacity) {
+        free(retired_ids);
+        retired_ids_capacity = retired_ids_capacity ? retired_ids_capacity * 2 : 64;
+        retired_ids = xrealloc(NULL, retired_ids_capacity * sizeof(int));
+        memset(retired_ids, 0xff, retired_ids_capacity * sizeof(int)); // All -1
+        for (int j = named_count; j < i; j++) {
+            register_retired(j);
+        }
+    }
+    uint32_t mask = retired_ids_capacity - 1;
+    uint32_t h = hash_string(service_command(i)) & mask;
+    while (retired_ids[h] >= 0) {
+        h = (h + 1) & mask;
+    }
+    retired_ids[h] = i;
+}
+
+void clear_service_ids() {
+    if (service_ids) memset(service_ids, 0xff, service_ids_capacity * sizeof(int));
+    if (retired_ids) memset(retired_ids, 0xff, retired_ids_capacity * sizeof(int));
+    dep_ids_count = 0;
+}
+
+// Append an empty slot to the table, growing it geometrically.
+int add_service() {
+    if (process_count == process_capacity) {
+        process_capacity = process_capacity ? process_capacity * 2 : TABLE_INITIAL_CAPACITY;
+        processes = xrealloc(processes, process_capacity * sizeof(Process));
+        process_config = xrealloc(process_config, process_capacity * sizeof(ProcessConfig));
+        boot_order = xrealloc(boot_order, process_capacity * sizeof(int));
+    }
+    return process_count++;
+}
+
+uint32_t hash_pid(pid_t pid) {
+    return (uint32_t)pid * 2654435761u;
+}
+
+void pid_index_insert(pid_t pid, int slot);
+
+void grow_pid_index() {
+    uint32_t old_capacity = pid_index_capacity;
+    PidEntry *old_entries = pid_index;
+    pid_index_capacity = old_capacity ? old_capacity * 2 : 64;
+    pid_index = calloc(pid_index_capacity, sizeof(PidEntry));
+    if (!pid_index) {
+        log_message(LOG_ERROR, "Out of memory");
+        log_flush();
+        exit(EXIT_FAILURE);
+    }
+    pid_index_count = 0;
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (old_entries[i].pid) {
+            pid_index_insert(old_entries[i].pid, old_entries[i].slot);
+        }
+    }
+    free(old_entries);
+}
+
+void pid_index_insert(pid_t pid, int slot) {
+    if ((pid_index_count + 1) * 2 > pid_index_capacity) grow_pid_index();
+    uint32_t mask = pid_index_capacity - 1;
+    uint32_t h = hash_pid(pid) & mask;
+    while (pid_index[h].pid && pid_index[h].pid != pid) h = (h + 1) & mask;
+    if (!pid_index[h].pid) pid_index_count++;
+    pid_index[h] = (PidEntry){pid, slot};
+}
+
+// Remove pid and return its slot, or -1 if it is not a supervised child.
+// Uses backward-shift deletion so lookups never need tombstones.
+int pid_index_remove(pid_t pid) {
+    if (pid_index_count == 0) return -1;
+    uint32_t mask = pid_index_capacity - 1;
+    uint32_t h = hash_pid(pid) & mask;
+    while (pid_index[h].pid != pid) {
+        if (!pid_index[h].pid) return -1;
+        h = (h + 1) & mask;
+    }
+    int slot = pid_index[h].slot;
+    pid_index_count--;
+
+    uint32_t hole = h;
+    for (uint32_t j = (h + 1) & mask; pid_index[j].pid; j = (j + 1) & mask) {
+        uint32_t home = hash_pid(pid_index[j].pid) & mask;
+        // Move the entry back if the hole lies between its home and j
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            pid_index[hole] = pid_index[j];
+            hole = j;
+        }
+    }
+    pid_index[hole].pid = 0;
+    return slot;
+}
+
+void pid_index_clear() {
+    if (pid_index) memset(pid_index, 0, pid_index_capacity * sizeof(PidEntry));
+    pid_index_count = 0;
+}
+
+void set_state(int i, ServiceState state);
+void mark_running(int i);
+
+// Files we own. INIT_ROOT, if set, is prefixed to every one of them, so a
+// second supervisor can run beside the real one, e.g. under init_bench. Its
+// service groups go under a root of its own next to CGROUP_ROOT, so it can
+// never signal a real service's group.
+const char *config_file = CONFIG_FILE;
+const char *config_cache_dir = CONFIG_CACHE_DIR;
+const char *config_cache = CONFIG_CACHE;
+const char *config_cache_tmp = CONFIG_CACHE ".tmp";
+const char *log_file = LOG_FILE;
+const char *log_binary_file = LOG_BINARY_FILE;
+const char *ctl_socket_path = CTL_SOCKET_PATH;
+const char *cgroup_root = CGROUP_ROOT;
+
+char *root_path(const char *root, const char *path) {
+    size_t len = strlen(root) + strlen(path) + 1;
+    char *joined = xrealloc(NULL, len);
+    snprintf(joined, len, "%s%s", root, path);
+    return joined;
+}
+
+void paths_init() {
+    const char *root = getenv("INIT_ROOT");
+    if (!root || !*root) return;
+    config_file = root_path(root, CONFIG_FILE);
+    config_cache_dir = root_path(root, CONFIG_CACHE_DIR);
+    config_cache = root_path(root, CONFIG_CACHE);
+    config_cache_tmp = root_path(root, CONFIG_CACHE ".tmp");
+    log_file = root_path(root, LOG_FILE);
+    log_binary_file = root_path(root, LOG_BINARY_FILE);
+    ctl_socket_path = root_path(root, CTL_SOCKET_PATH);
+    char group[64];
+    snprintf(group, sizeof(group), CGROUP_TEST_ROOT, getpid());
+    cgroup_root = strdup(group);
+}
+
+// Log lines are formatted into log_ring and written out in batches by
+// log_flush(), which the event loop calls before it goes back to sleep. The
+// log file stays open with O_APPEND and its size is tracked here, so logging a
+// line costs no syscalls and rotation needs no stat(). Producer and consumer
+// both run on the supervisor thread, so the ring needs no locking.
+char log_ring[LOG_RING_SIZE];
+uint32_t log_head = 0; // Total bytes queued; masked on use
+uint32_t log_tail = 0; // Total bytes written out
+int log_fd = -1;
+off_t log_size = 0;
+
+// With INIT_LOG_FORMAT=binary (settable from the kernel command line) events
+// are queued as LogRecords instead of text, and no formatting happens in PID 1
+// at all; init_logdump renders them later.
+#if INIT_BINARY_LOG
+bool log_binary = false;
+#else
+const bool log_binary = false;
+#endif
+uint32_t log_sequence = 0;
+
+const char *log_path() {
+    return log_binary ? log_binary_file : log_file;
+}
+
+#if INIT_BINARY_LOG
+// Serialize a record and its text into buf; returns the padded length.
+uint32_t encode_log_record(char *buf, uint32_t size, LogRecord *rec, const char *text) {
+    uint32_t text_len = strlen(text);
+    if (text_len > size - sizeof(LogRecord) - 8) text_len = size - sizeof(LogRecord) - 8;
+    rec->text_len = text_len;
+    uint32_t len = (sizeof(LogRecord) + text_len + 7) & ~7u;
+    memcpy(buf, rec, sizeof(LogRecord));
+    memcpy(buf + sizeof(LogRecord), text, text_len);
+    memset(buf + sizeof(LogRecord) + text_len, 0, len - sizeof(LogRecord) - text_len);
+    return len;
+}
+#endif
+
+uint64_t realtime_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+#if INIT_BINARY_LOG
+// Write the ID -> name map at the start of a fresh binary file, so every
+// rotated file can be decoded on its own.
+void log_write_service_names() {
+    char buf[4096];
+    uint32_t used = 0;
+    for (int i = 0; i < process_count; i++) {
+        if (used + sizeof(LogRecord) + 264 > sizeof(buf)) {
+            if (write(log_fd, buf, used) > 0) log_size += used;
+            used = 0;
+        }
+        LogRecord rec = {realtime_ns(), log_sequence++, LOG_INFO, EV_SERVICE_NAME, 0, i, 0, {0, 0}};
+        used += encode_log_record(buf + used, sizeof(LogRecord) + 264, &rec, arena_str(process_config[i].command));
+    }
+    if (used > 0 && write(log_fd, buf, used) > 0) log_size += used;
+}
+#endif
+
+void log_open() {
+    log_fd = open(log_path(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+    log_size = (log_fd >= 0 && fstat(log_fd, &st) == 0) ? st.st_size : 0;
+#if INIT_BINARY_LOG
+    if (log_binary && log_fd >= 0 && log_size == 0) {
+        if (write(log_fd, LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LEN) == LOG_BINARY_MAGIC_LEN) {
+            log_size = LOG_BINARY_MAGIC_LEN;
+        }
+    }
+#endif
+}
+
+void log_rotate() {
+    char new_log_file[PATH_MAX];
+    snprintf(new_log_file, sizeof(new_log_file), "%s.%ld", log_path(), time(NULL));
+    rename(log_path(), new_log_file);
+    close(log_fd);
+    log_open();
+#if INIT_BINARY_LOG
+    if (log_binary && log_fd >= 0) log_write_service_names();
+#endif
+}
+
+void log_flush() {
+    if (log_tail == log_head) return;
+    uint64_t started = monotonic_us();
+    while (log_tail != log_head) {
+        if (log_fd < 0) log_open();
+        if (log_fd < 0) {
+            log_tail = log_head; // Nowhere to write yet, e.g. /var/log not mounted
+            return;
+        }
+
+        uint32_t pending = log_head - log_tail;
+        uint32_t start = log_tail & (LOG_RING_SIZE - 1);
+        uint32_t first = pending < LOG_RING_SIZE - start ? pending : LOG_RING_SIZE - start;
+        struct iovec iov[2] = {{log_ring + start, first}, {log_ring, pending - first}};
+        ssize_t written = writev(log_fd, iov, pending > first ? 2 : 1);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            log_tail = log_head;
+            return;
+        }
+        log_tail += written;
+        log_size += written;
+    }
+    // Only once the ring is empty, so the old file keeps every record numbered
+    // before the new file's service names
+    if (log_size >= MAX_LOG_SIZE) log_rotate();
+    histogram_record(&flush_latency, monotonic_us() - started);
+}
+
+void log_append(const char *data, uint32_t len) {
+    if (len > LOG_RING_SIZE - (log_head - log_tail)) {
+        log_flush(); // Ring full; write synchronously rather than drop lines
+    }
+    uint32_t start = log_head & (LOG_RING_SIZE - 1);
+    uint32_t first = len < LOG_RING_SIZE - start ? len : LOG_RING_SIZE - start;
+    memcpy(log_ring + start, data, first);
+    memcpy(log_ring, data + first, len - first);
+    log_head += len;
+}
+
+// Log a supervisor event about service (-1 for none). In text mode this
+// renders the same line init_logdump would print for the binary record.
+void log_event(LogLevel level, LogEvent event, int service, pid_t pid, int arg0, int arg1, const char *text) {
+    LogRecord rec = {0, log_sequence++, level, event, 0, service, pid, {arg0, arg1}};
+    char line[1024];
+    if (!text) text = "";
+
+#if INIT_BINARY_LOG
+    if (log_binary) {
+        rec.timestamp_ns = realtime_ns();
+        log_append(line, encode_log_record(line, sizeof(line), &rec, text));
+        return;
+    }
+#endif
+
+    int prefix = snprintf(line, sizeof(line), "[%s] ", log_level_names[level]);
+    const char *name = service >= 0 ? service_command(service) : "";
+    int len = prefix + format_log_record(line + prefix, sizeof(line) - prefix - 1, &rec, name, text);
+    if (len > (int)sizeof(line) - 2) len = sizeof(line) - 2;
+    line[len++] = '\n';
+    log_append(line, len);
+}
+
+void log_message(LogLevel level, const char *message) {
+    log_event(level, EV_MESSAGE, -1, 0, 0, 0, message);
+}
+
+void start_process(int i);
+void restart_service(int i);
+void retired_service_stopped(int i);
+void alive_timeout(int i);
+void listen_watch(int i, uint32_t events);
+void service_kill(int i, int sig);
+bool cgroup_populated(const ProcessConfig *cfg);
+int cgroup_service(pid_t pid);
+void cgroup_remove();
+extern int cgroup_root_fd;
+
+// Pending restarts and stop deadlines, a binary min-heap on due time armed on
+// service_timer_fd. Entries are not removed when a timer is cancelled; one
+// whose due time no longer matches its service's restart_at or kill_at is
+// simply skipped when it comes up.
+typedef struct {
+    uint64_t due; // CLOCK_MONOTONIC ms
+    int slot;
+} ServiceTimer;
+
+ServiceTimer *service_timers;
+uint32_t service_timers_count = 0;
+uint32_t service_timers_capacity = 0;
+int restart_limit = RESTART_LIMIT;
+int restart_delay_max = RESTART_DELAY_MAX_MS;
+int stop_timeout = STOP_TIMEOUT_MS;
+
+void service_timer_arm() {
+    struct itimerspec when = {{0, 0}, {0, 0}};
+    if (service_timers_count > 0) {
+        uint64_t due = service_timers[0].due;
+        when.it_value.tv_sec = due / 1000;
+        when.it_value.tv_nsec = due % 1000 * 1000000 + 1; // Zero would disarm the timer
+    }
+    timerfd_settime(service_timer_fd, TFD_TIMER_ABSTIME, &when, NULL);
+}
+
+void service_timer_push(uint64_t due, int slot) {
+    if (service_timers_count == service_timers_capacity) {
+        service_timers_capacity = service_timers_capacity ? service_timers_capacity * 2 : TABLE_INITIAL_CAPACITY;
+        service_timers = xrealloc(service_timers, service_timers_capacity * sizeof(ServiceTimer));
+    }
+    uint32_t k = service_timers_count++;
+    while (k > 0 && service_timers[(k - 1) / 2].due > due) {
+        service_timers[k] = service_timers[(k - 1) / 2];
+        k = (k - 1) / 2;
+    }
+    service_timers[k] = (ServiceTimer){due, slot};
+}
+
+ServiceTimer service_timer_pop() {
+    ServiceTimer top = service_timers[0];
+    ServiceTimer last = service_timers[--service_timers_count];
+    uint32_t k = 0;
+    while (2 * k + 1 < service_timers_count) {
+        uint32_t child = 2 * k + 1;
+        if (child + 1 < service_timers_count && service_timers[child + 1].due < service_timers[child].due) {
+            child++;
+        }
+        if (last.due <= service_timers[child].due) break;
+        service_timers[k] = service_timers[child];
+        k = child;
+    }
+    service_timers[k] = last;
+    return top;
+}
+
+// A service exited on its own or could not be exec'd. Restart it after an
+// exponential backoff with jitter, or give up on it if it keeps crashing, so
+// a flapping binary cannot keep the supervisor forking.
+void service_crashed(int i) {
+    Process *p = &processes[i];
+    ProcessConfig *cfg = &process_config[i];
+    time_t now = monotonic_now();
+    set_state(i, STATE_CRASHED);
+
+    if (p->restart_count == 0 || now - cfg->crash_window_start >= RESTART_WINDOW) {
+        p->restart_count = 0;
+        cfg->crash_window_start = now;
+    }
+    if (p->restart_count >= restart_limit) {
+        log_event(LOG_ERROR, EV_CRASH_LOOP, i, 0, p->restart_count, RESTART_WINDOW, NULL);
+        set_state(i, STATE_FAILED);
+        return;
+    }
+
+    // Equal jitter: half the backoff is fixed, the other half random, so
+    // services that crashed together do not all come back together
+    uint64_t delay = (uint64_t)RESTART_DELAY_BASE_MS << (p->restart_count < 16 ? p->restart_count : 16);
+    if (delay > (uint64_t)restart_delay_max) delay = restart_delay_max;
+    delay = delay / 2 + (uint64_t)random() % (delay / 2 + 1);
+
+    p->restart_count++;
+    cfg->restarts_total++;
+    cfg->restart_at = monotonic_ms() + delay;
+    log_event(LOG_INFO, EV_RESTART_SCHEDULED, i, 0, delay, p->restart_count, NULL);
+    service_timer_push(cfg->restart_at, i);
+    service_timer_arm();
+}
+
+// A crashed service's backoff is over. If a dependency is down, e.g. it
+// crashed along with it, wait for it instead of failing to start.
+void restart_crashed(int i) {
+    log_event(LOG_INFO, EV_RESTARTING, i, 0, 0, 0, NULL);
+    if (process_config[i].deps_down > 0) {
+        set_state(i, STATE_WAITING); // Started by set_state() once its dependencies are up
+        return;
+    }
+    start_process(i);
+}
+
+// Ask a service to exit, and make sure it does: if it is still around when
+// its deadline passes, it is killed.
+void watch_alive(int i, uint64_t deadline) {
+    ProcessConfig *cfg = &process_config[i];
+    cfg->alive_at = deadline;
+    if (deadline && !cfg->alive_timer) {
+        // One heap entry per service; heartbeats only move alive_at
+        cfg->alive_timer = deadline;
+        service_timer_push(deadline, i);
+        service_timer_arm();
+    }
+}
+
+void signal_stop(int i) {
+    ProcessConfig *cfg = &process_config[i];
+    if (processes[i].pid <= 0) return;
+    service_kill(i, SIGTERM);
+    if (cfg->kill_at) return; // Already on the clock
+    cfg->stop_started = monotonic_ms();
+    cfg->kill_at = cfg->stop_started + stop_timeout;
+    cfg->stop_killed = false;
+    service_timer_push(cfg->kill_at, i);
+    service_timer_arm();
+}
+
+// service_timer_fd fired: start every service whose backoff has run out and
+// kill every one that overran its stop deadline.
+void service_timers_expired() {
+    uint64_t now = monotonic_ms();
+    while (service_timers_count > 0 && service_timers[0].due <= now) {
+        ServiceTimer t = service_timer_pop();
+        if (t.slot >= process_count) {
+            continue; // Left over from before a reload
+        }
+        ProcessConfig *cfg = &process_config[t.slot];
+        if (cfg->kill_at == t.due) {
+            cfg->kill_at = 0;
+            if (processes[t.slot].pid > 0) {
+                log_event(LOG_WARNING, EV_STOP_TIMEOUT, t.slot, processes[t.slot].pid, now - cfg->stop_started, 0,
+                          NULL);
+                cfg->stop_killed = true;
+                service_kill(t.slot, SIGKILL);
+            }
+        }
+        if (cfg->restart_at == t.due) {
+            cfg->restart_at = 0;
+            if (processes[t.slot].state == STATE_CRASHED) {
+                restart_crashed(t.slot);
+            }
+        }
+        if (cfg->alive_timer == t.due) {
+            cfg->alive_timer = 0;
+            if (cfg->alive_at > now) {
+                watch_alive(t.slot, cfg->alive_at); // Heartbeats moved the deadline
+            } else if (cfg->alive_at && processes[t.slot].pid > 0) {
+                alive_timeout(t.slot);
+            }
+        }
+    }
+    service_timer_arm();
+}
+
+void shutdown_complete();
+void mark_running(int i);
+
+// A ready=notify service never became ready, or a running one stopped sending
+// its heartbeat. It is stopped as hung; the reaper then takes its exit for a
+// crash and the normal backoff applies.
+void alive_timeout(int i) {
+    ProcessConfig *cfg = &process_config[i];
+    cfg->alive_at = 0;
+    if (processes[i].state == STATE_STARTING) {
+        log_event(LOG_ERROR, EV_START_TIMEOUT, i, processes[i].pid, START_TIMEOUT_MS, 0, NULL);
+    } else if (processes[i].state == STATE_RUNNING) {
+        log_event(LOG_ERROR, EV_WATCHDOG_TIMEOUT, i, processes[i].pid, cfg->watchdog_ms, 0, NULL);
+    } else {
+        return;
+    }
+    signal_stop(i);
+}
+
+void notify_message(int i, char *message) {
+    ProcessConfig *cfg = &process_config[i];
+    char *save = NULL;
+    for (char *line = strtok_r(message, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        if (strcmp(line, "READY=1") == 0 && processes[i].state == STATE_STARTING) {
+            log_event(LOG_INFO, EV_READY, i, processes[i].pid, (monotonic_us() - cfg->start_time) / 1000, 0, NULL);
+            watch_alive(i, cfg->watchdog_ms ? monotonic_ms() + cfg->watchdog_ms : 0);
+            mark_running(i);
+        } else if (strcmp(line, "WATCHDOG=1") == 0 && cfg->watchdog_ms && processes[i].state == STATE_RUNNING) {
+            watch_alive(i, monotonic_ms() + cfg->watchdog_ms);
+        }
+    }
+}
+
+// The notify socket is readable. Take at most one batch of datagrams with a
+// single recvmmsg(); anything left keeps the fd ready for the next epoll_wait,
+// after every other ready service has had its turn.
+void notify_read(int i) {
+    static char buffers[NOTIFY_BATCH][NOTIFY_MESSAGE_MAX];
+    struct iovec iov[NOTIFY_BATCH];
+    struct mmsghdr msgs[NOTIFY_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for (int k = 0; k < NOTIFY_BATCH; k++) {
+        iov[k] = (struct iovec){buffers[k], NOTIFY_MESSAGE_MAX - 1};
+        msgs[k].msg_hdr.msg_iov = &iov[k];
+        msgs[k].msg_hdr.msg_iovlen = 1;
+    }
+    int n = recvmmsg(process_config[i].notify_fd, msgs, NOTIFY_BATCH, MSG_DONTWAIT, NULL);
+    for (int k = 0; k < n; k++) {
+        buffers[k][msgs[k].msg_len] = '\0';
+        notify_message(i, buffers[k]);
+    }
+}
+
+// Reap every exited child. Runs from the event loop when the signalfd reports
+// SIGCHLD, so it is free to log and restart without async-signal constraints.
+// The wait status waitpid() would have returned for a waitid() result
+int wait_status(const siginfo_t *info) {
+    if (info->si_code == CLD_EXITED) return (info->si_status & 0xff) << 8;
+    return (info->si_status & 0x7f) | (info->si_code == CLD_DUMPED ? 0x80 : 0);
+}
+
+// The main process of service i has been reaped. Whatever it left in its
+// cgroup is killed with it: a service is its whole process tree.
+void service_exited(int i, pid_t pid, int status) {
+    log_event(LOG_INFO, EV_EXITED, i, pid, status, 0, NULL);
+    trace_event(TRACE_EXIT, monotonic_us(), i, pid, status, -1);
+    processes[i].pid = 0;
+    ProcessConfig *cfg = &process_config[i];
+    if (cfg->stop_started) {
+        cfg->stop_ms = monotonic_ms() - cfg->stop_started;
+        cfg->stop_started = cfg->kill_at = 0;
+    }
+    if (cfg->notify_fd >= 0) {
+        close(cfg->notify_fd); // Also drops it from epoll
+        cfg->notify_fd = -1;
+    }
+    cfg->alive_at = 0;
+    listen_watch(i, 0);
+    if (cgroup_populated(cfg)) {
+        service_kill(i, SIGKILL); // A restart below waits for them to be gone
+    }
+    if (processes[i].state == STATE_RESTARTING) {
+        start_process(i);
+    } else if (processes[i].state == STATE_RUNNING || processes[i].state == STATE_STARTING) {
+        // Deliberate stops change the state before the kill
+        service_crashed(i);
+    } else if (processes[i].state == STATE_STOPPING && cfg->idle_stopping) {
+        cfg->idle_stopping = false;
+        set_state(i, STATE_LISTENING);
+        listen_watch(i, EPOLLIN);
+    } else if (processes[i].state == STATE_STOPPING) {
+        set_state(i, STATE_STOPPED);
+        if (i >= named_count) {
+            retired_service_stopped(i);
+        }
+    }
+}
+
+// A child collected by reap_batch()
+typedef struct {
+    pid_t pid;
+    int status; // As waitpid() would return it
+    int slot;   // Service it was the main process of, -1 for an orphan
+    int owner;  // For an orphan, the service whose cgroup it was in, -1 if none
+} ReapedChild;
+
+// Collect up to REAP_BATCH exited children before handling any, so no zombie
+// waits for the restarts of the exits collected before it. Each leaves the
+// PID index here: handling one can fork a child that reuses another's PID.
+//
+// Orphans, e.g. the grandchildren a daemon leaves behind when it
+// double-forks, are reparented to us as PID 1 or as a subreaper. With
+// cgroups every child is peeked at with WNOWAIT first, so an orphan's cgroup,
+// and with it its service, can still be read before it is reaped.
+int reap_batch(ReapedChild *batch) {
+    int count = 0;
+    bool peek = cgroup_root_fd >= 0;
+    while (count < REAP_BATCH) {
+        siginfo_t info;
+        info.si_pid = 0;
+        if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | (peek ? WNOWAIT : 0)) < 0 || info.si_pid == 0) break;
+        ReapedChild *child = &batch[count++];
+        child->pid = info.si_pid;
+        child->status = wait_status(&info);
+        child->slot = pid_index_remove(info.si_pid);
+        child->owner = child->slot < 0 && peek ? cgroup_service(info.si_pid) : -1;
+        if (peek) {
+            waitid(P_PID, info.si_pid, &info, WEXITED);
+        }
+        if (child->slot >= 0) {
+            histogram_record(&reap_lag, monotonic_us() - wakeup_us);
+        }
+    }
+    return count;
+}
+
+void reap_children() {
+    ReapedChild batch[REAP_BATCH];
+    int count;
+    do {
+        count = reap_batch(batch);
+        for (int k = 0; k < count; k++) {
+            if (batch[k].slot < 0) {
+                log_event(LOG_INFO, EV_ORPHAN_REAPED, batch[k].owner, batch[k].pid, batch[k].status, 0, NULL);
+            } else {
+                service_exited(batch[k].slot, batch[k].pid, batch[k].status);
+            }
+        }
+    } while (count == REAP_BATCH);
+    if (shutting_down) {
+        shutdown_complete();
+    }
+}
+
+bool check_all_dependencies_active(int i) {
+    return process_config[i].deps_down == 0;
+}
+
+// cgroup v2 manager. Every service gets its own group under cgroup_root,
+// created and configured once when the table is loaded rather than on every
+// start. The directory and cgroup.procs fds stay open, so (re)starting a
+// service costs no path lookups and no control file writes.
+int cgroup_root_fd = -1;
+
+#if INIT_CGROUPS
+
+bool cgroup_write(int dir_fd, const char *file, const char *value) {
+    int fd = openat(dir_fd, file, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = write(fd, value, strlen(value)) == (ssize_t)strlen(value);
+    close(fd);
+    return ok;
+}
+
+// Create cgroup_root and enable the memory and cpu controllers for the
+// service groups below it. Without cgroup v2 services simply run unconfined.
+void cgroup_init() {
+    char message[PATH_MAX + 64];
+    struct statfs fs;
+    int top_fd = open(CGROUP_MOUNT, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (top_fd < 0 || fstatfs(top_fd, &fs) < 0 || fs.f_type != CGROUP2_SUPER_MAGIC) {
+        log_message(LOG_WARNING, "cgroup v2 not mounted; resource limits disabled");
+        if (top_fd >= 0) close(top_fd);
+        return;
+    }
+    cgroup_write(top_fd, "cgroup.subtree_control", "+memory +cpu");
+    close(top_fd);
+
+    if (mkdir(cgroup_root, 0755) < 0 && errno != EEXIST) {
+        snprintf(message, sizeof(message), "Cannot create %s; resource limits disabled", cgroup_root);
+        log_message(LOG_WARNING, message);
+        return;
+    }
+    cgroup_root_fd = open(cgroup_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cgroup_root_fd >= 0 && !cgroup_write(cgroup_root_fd, "cgroup.subtree_control", "+memory +cpu")) {
+        snprintf(message, sizeof(message), "Cannot enable memory and cpu controllers in %s", cgroup_root);
+        log_message(LOG_WARNING, message);
+    }
+}
+
+// Group name for a service: its command without the leading '/' and with
+// every other '/' turned into '-'. '-', backslashes, a leading '.' and
+// anything unprintable are escaped as \xNN, and a relative command starts
+// with \r, so no two services share a group: /usr/sbin/sshd ->
+// usr-sbin-sshd, /opt/a-b -> opt-a\x2db. A name too long for a directory
+// entry is cut short and ends in \h and a hash of the whole command instead.
+void cgroup_name(int i, char *buf, size_t size) {
+    const char *command = service_command(i);
+    size_t n = 0;
+    if (*command == '/') {
+        command++;
+    } else {
+        n += snprintf(buf, size, "\\r");
+    }
+    const char *c = command;
+    for (; *c && n + 5 <= size; c++) {
+        unsigned char ch = *c;
+        if (ch == '/') {
+            buf[n++] = '-';
+        } else if (ch == '-' || ch == '\\' || ch <= ' ' || ch >= 0x7f || (ch == '.' && n == 0)) {
+            n += snprintf(buf + n, size - n, "\\x%02x", ch);
+        } else {
+            buf[n++] = ch;
+        }
+    }
+    if (*c) {
+        const char *full = service_command(i);
+        n = n < size - 19 ? n : size - 19;
+        snprintf(buf + n, size - n, "\\h%016llx", (unsigned long long)hash_bytes(full, strlen(full)));
+        return;
+    }
+    buf[n] = '\0';
+}
+
+void memory_events_read(int i, bool report);
+
+void cgroup_setup(int i) {
+    ProcessConfig *cfg = &process_config[i];
+    if (cgroup_root_fd < 0) return;
+
+    char name[256];
+    cgroup_name(i, name, sizeof(name));
+    if (mkdirat(cgroup_root_fd, name, 0755) < 0 && errno != EEXIST) {
+        log_message(LOG_WARNING, "Failed to create service cgroup");
+        return;
+    }
+    cfg->cgroup_fd = openat(cgroup_root_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cfg->cgroup_fd < 0) return;
+
+    char value[64];
+    if (cfg->memory_limit > 0) {
+        snprintf(value, sizeof(value), "%d", cfg->memory_limit);
+    } else {
+        strcpy(value, "max");
+    }
+    if (!cgroup_write(cfg->cgroup_fd, "memory.max", value) && cfg->memory_limit > 0) {
+        log_message(LOG_WARNING, "Failed to set memory limit");
+    }
+    if (cfg->cpu_limit > 0) {
+        // cpu_limit is a percentage of one CPU
+        snprintf(value, sizeof(value), "%d %d", cfg->cpu_limit * (CPU_PERIOD_US / 100), CPU_PERIOD_US);
+    } else {
+        snprintf(value, sizeof(value), "max %d", CPU_PERIOD_US);
+    }
+    if (!cgroup_write(cfg->cgroup_fd, "cpu.max", value) && cfg->cpu_limit > 0) {
+        log_message(LOG_WARNING, "Failed to set CPU limit");
+    }
+    cfg->cgroup_procs_fd = openat(cfg->cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+    cfg->cgroup_events_fd = openat(cfg->cgroup_fd, "cgroup.events", O_RDONLY | O_CLOEXEC);
+    if (cfg->cgroup_events_fd >= 0) {
+        watch_fd(cfg->cgroup_events_fd, EPOLLPRI, EVENT_CGROUP_EVENTS, i);
+    }
+    if (cfg->idle_ms) {
+        cfg->cpu_stat_fd = openat(cfg->cgroup_fd, "cpu.stat", O_RDONLY | O_CLOEXEC);
+    }
+
+    // Let the kernel throttle a service before it reaches its hard limit, and
+    // watch memory.events and PSI so we hear about it as it happens
+    if (cfg->memory_limit > 0) {
+        snprintf(value, sizeof(value), "%lld", (long long)cfg->memory_limit * MEMORY_HIGH_PERCENT / 100);
+    } else {
+        strcpy(value, "max");
+    }
+    cgroup_write(cfg->cgroup_fd, "memory.high", value);
+
+    cfg->memory_events_fd = openat(cfg->cgroup_fd, "memory.events", O_RDONLY | O_CLOEXEC);
+    if (cfg->memory_events_fd >= 0) {
+        memory_events_read(i, false);
+        watch_fd(cfg->memory_events_fd, EPOLLPRI, EVENT_MEMORY_EVENTS, i);
+    }
+    if (cfg->memory_limit > 0) {
+        cfg->memory_pressure_fd = openat(cfg->cgroup_fd, "memory.pressure", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (cfg->memory_pressure_fd >= 0 &&
+            write(cfg->memory_pressure_fd, MEMORY_PSI_TRIGGER, strlen(MEMORY_PSI_TRIGGER) + 1) < 0) {
+            close(cfg->memory_pressure_fd);
+            cfg->memory_pressure_fd = -1;
+        }
+        if (cfg->memory_pressure_fd >= 0) {
+            watch_fd(cfg->memory_pressure_fd, EPOLLPRI, EVENT_MEMORY_PRESSURE, i);
+        }
+    }
+}
+
+void cgroup_release(ProcessConfig *cfg) {
+    if (cfg->memory_pressure_fd >= 0) close(cfg->memory_pressure_fd);
+    if (cfg->memory_events_fd >= 0) close(cfg->memory_events_fd);
+    if (cfg->cgroup_events_fd >= 0) close(cfg->cgroup_events_fd);
+    if (cfg->cgroup_procs_fd >= 0) close(cfg->cgroup_procs_fd);
+    if (cfg->cgroup_fd >= 0) close(cfg->cgroup_fd);
+    if (cfg->cpu_stat_fd >= 0) close(cfg->cpu_stat_fd);
+    cfg->memory_pressure_fd = cfg->memory_events_fd = cfg->cgroup_procs_fd = cfg->cgroup_fd = cfg->cpu_stat_fd = -1;
+    cfg->cgroup_events_fd = -1;
+}
+
+// At exit, a supervisor under INIT_ROOT removes the groups it made, including
+// those of services it no longer has. Groups still holding processes stay, as
+// does the real CGROUP_ROOT.
+void cgroup_remove() {
+    if (cgroup_root_fd < 0 || strcmp(cgroup_root, CGROUP_ROOT) == 0) return;
+    int fd = fcntl(cgroup_root_fd, F_DUPFD_CLOEXEC, 0);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    bool removed = dir != NULL;
+    while (removed) { // Removing entries can make readdir() skip others; go again until none goes
+        removed = false;
+        rewinddir(dir);
+        struct dirent *entry;
+        while ((entry = readdir(dir))) {
+            if (entry->d_type == DT_DIR && entry->d_name[0] != '.' && // Everything else is a control file
+                unlinkat(cgroup_root_fd, entry->d_name, AT_REMOVEDIR) == 0) {
+                removed = true;
+            }
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    } else if (fd >= 0) {
+        close(fd);
+    }
+    rmdir(cgroup_root);
+}
+
+uint32_t cgroup_counter(const char *buf, const char *key) {
+    size_t len = strlen(key);
+    for (const char *line = buf; line; line = strchr(line, '\n')) {
+        if (*line == '\n') line++;
+        if (strncmp(line, key, len) == 0 && line[len] == ' ') {
+            return strtoul(line + len + 1, NULL, 10);
+        }
+    }
+    return 0;
+}
+
+// memory.current as a percentage of the service's memory_limit
+int memory_usage_percent(int i) {
+    char buf[32];
+    int fd = openat(process_config[i].cgroup_fd, "memory.current", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return 0;
+    buf[n] = '\0';
+    return strtoull(buf, NULL, 10) * 100 / process_config[i].memory_limit;
+}
+
+// Whether any process is left in a service's cgroup
+bool cgroup_populated(const ProcessConfig *cfg) {
+    char buf[256];
+    ssize_t n = cfg->cgroup_events_fd >= 0 ? pread(cfg->cgroup_events_fd, buf, sizeof(buf) - 1, 0) : -1;
+    if (n <= 0) return false;
+    buf[n] = '\0';
+    return cgroup_counter(buf, "populated") != 0;
+}
+
+// cgroup.events changed: if a start was waiting for the cgroup to empty and
+// it now has, go ahead, unless the service was stopped in the meantime.
+void cgroup_events_read(int i) {
+    ProcessConfig *cfg = &process_config[i];
+    if (!cfg->start_when_empty || cgroup_populated(cfg)) return;
+    cfg->start_when_empty = false;
+    if (processes[i].pid == 0 && processes[i].state != STATE_STOPPED && processes[i].state != STATE_FAILED) {
+        start_process(i);
+    }
+}
+
+// Signal every process of a service: all of its cgroup, including what its
+// daemons have double-forked, or only its main process without cgroups.
+// SIGKILL goes through cgroup.kill where the kernel has it (5.14), which
+// also catches processes forked while the kill is under way.
+void service_kill(int i, int sig) {
+    const ProcessConfig *cfg = &process_config[i];
+    pid_t main_pid = processes[i].pid;
+    bool main_signalled = false;
+    if (cfg->cgroup_fd >= 0 && (sig != SIGKILL || !cgroup_write(cfg->cgroup_fd, "cgroup.kill", "1"))) {
+        int fd = openat(cfg->cgroup_fd, "cgroup.procs", O_RDONLY | O_CLOEXEC);
+        FILE *procs = fd >= 0 ? fdopen(fd, "r") : NULL;
+        int pid;
+        while (procs && fscanf(procs, "%d", &pid) == 1) {
+            kill(pid, sig);
+            main_signalled |= pid == main_pid;
+        }
+        if (procs) {
+            fclose(procs);
+        } else if (fd >= 0) {
+            close(fd);
+        }
+    } else if (cfg->cgroup_fd >= 0) {
+        main_signalled = true;
+    }
+    if (main_pid > 0 && !main_signalled) {
+        kill(main_pid, sig); // Not in its cgroup, e.g. when it could not be joined
+    }
+}
+
+// The service with a command that cgroup_name() had to cut short: it starts
+// with prefix and hashes to hash. Commands that long are rare enough that a
+// scan will do.
+int cgroup_service_hashed(const char *prefix, size_t len, uint64_t hash) {
+    for (int i = 0; i < process_count; i++) {
+        const char *command = service_command(i);
+        if (strncmp(command, prefix, len) == 0 && hash_bytes(command, strlen(command)) == hash) return i;
+    }
+    return -1;
+}
+
+// The service a cgroup_name() of len bytes belongs to, or -1. cgroup_name()
+// is injective, so this undoes it and looks the command up. A name it cut
+// short ends in "\h" and a hash instead, possibly after a partial escape; a
+// backslash of the command's own is always escaped.
+int cgroup_name_service(const char *name, size_t len) {
+    if (len >= 256) return -1; // Longer than any cgroup_name()
+
+    bool hashed = len >= 18 && name[len - 18] == '\\' && name[len - 17] == 'h';
+    size_t end = hashed ? len - 18 : len;
+    char command[258];
+    size_t used = 0, k = 0;
+    if (end >= 2 && name[0] == '\\' && name[1] == 'r') {
+        k = 2;
+    } else {
+        command[used++] = '/';
+    }
+    while (k < end) {
+        if (name[k] == '-') {
+            command[used++] = '/';
+            k++;
+        } else if (name[k] != '\\') {
+            command[used++] = name[k++];
+        } else if (k + 4 <= end && name[k + 1] == 'x') {
+            char hex[3] = {name[k + 2], name[k + 3], '\0'};
+            command[used++] = strtol(hex, NULL, 16);
+            k += 4;
+        } else if (hashed) {
+            break;
+        } else {
+            return -1;
+        }
+    }
+    command[used] = '\0';
+    if (hashed) {
+        char hex[17];
+        memcpy(hex, name + len - 16, 16);
+        hex[16] = '\0';
+        return cgroup_service_hashed(command, used, strtoull(hex, NULL, 16));
+    }
+    int i = find_service(command); // Shares its cgroup with any retired namesake
+    return i >= 0 ? i : find_retired(command);
+}
+
+// The service whose cgroup a process is in, from /proc/PID/cgroup; works
+// for a zombie until it is reaped. -1 if it is in none of ours.
+int cgroup_service(pid_t pid) {
+    char path[32], buf[512], prefix[64];
+    snprintf(path, sizeof(path), "/proc/%d/cgroup", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+
+    // The unified hierarchy's line, "0::/init/NAME"
+    snprintf(prefix, sizeof(prefix), "0::%s/", cgroup_root + strlen(CGROUP_MOUNT));
+    const char *line = buf;
+    while (line && strncmp(line, prefix, strlen(prefix)) != 0) {
+        line = strchr(line, '\n');
+        if (line) line++;
+    }
+    if (!line) return -1;
+    const char *own = line + strlen(prefix);
+    size_t len = strcspn(own, "/\n");
+    return cgroup_name_service(own, len);
+}
+
+// memory.events changed: log what moved since last time, and replace a
+// service whose process was OOM killed instead of limping on without it.
+void memory_events_read(int i, bool report) {
+    ProcessConfig *cfg = &process_config[i];
+    char buf[256];
+    ssize_t n = pread(cfg->memory_events_fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) return;
+    buf[n] = '\0';
+
+    uint32_t high = cgroup_counter(buf, "high");
+    uint32_t max = cgroup_counter(buf, "max");
+    uint32_t oom_kill = cgroup_counter(buf, "oom_kill");
+    if (report && high != cfg->memory_high) {
+        log_event(LOG_WARNING, EV_MEMORY_HIGH, i, processes[i].pid, high, 0, NULL);
+    }
+    if (report && max != cfg->memory_max) {
+        log_event(LOG_WARNING, EV_MEMORY_MAX, i, processes[i].pid, max, 0, NULL);
+    }
+    if (report && oom_kill != cfg->memory_oom_kill) {
+        log_event(LOG_ERROR, EV_OOM_KILL, i, processes[i].pid, oom_kill, 0, NULL);
+        if (processes[i].state == STATE_RUNNING) {
+            restart_service(i);
+        }
+    }
+    cfg->memory_high = high;
+    cfg->memory_max = max;
+    cfg->memory_oom_kill = oom_kill;
+}
+
+// The PSI trigger fired: the service spent too long stalled on memory. Near
+// its limit that means the OOM killer is next, so restart it on our terms.
+void memory_pressure_event(int i) {
+    if (processes[i].state != STATE_RUNNING) return;
+    int percent = memory_usage_percent(i);
+    if (percent >= MEMORY_RESTART_PERCENT) {
+        log_event(LOG_WARNING, EV_MEMORY_RESTART, i, processes[i].pid, percent, 0, NULL);
+        restart_service(i);
+    } else {
+        log_event(LOG_WARNING, EV_MEMORY_PRESSURE, i, processes[i].pid, percent, 0, NULL);
+    }
+}
+#else
+// Built without cgroups, as at runtime when cgroup v2 is not mounted:
+// services run unconfined and only their main process is signalled
+void cgroup_init() {
+}
+
+void cgroup_remove() {
+}
+
+void cgroup_setup(int i) {
+    (void)i;
+}
+
+void cgroup_release(ProcessConfig *cfg) {
+    (void)cfg;
+}
+
+bool cgroup_populated(const ProcessConfig *cfg) {
+    (void)cfg;
+    return false;
+}
+
+void cgroup_events_read(int i) {
+    (void)i;
+}
+
+void service_kill(int i, int sig) {
+    if (processes[i].pid > 0) kill(processes[i].pid, sig);
+}
+
+int cgroup_service(pid_t pid) {
+    (void)pid;
+    return -1;
+}
+
+void memory_events_read(int i, bool report) {
+    (void)i;
+    (void)report;
+}
+
+void memory_pressure_event(int i) {
+    (void)i;
+}
+#endif
+
+// Everything the child does between clone() and exec, prepared by the parent
+// so the child itself makes nothing but a few syscalls.
+typedef struct {
+    const char *path;
+    char *const *argv;
+    int cgroup_fd;       // Target cgroup directory for CLONE_INTO_CGROUP, -1 for none
+    int cgroup_procs_fd; // Joined by writing "0" when not placed by clone3(), -1 for none
+    char *const *envp;
+    int fds[LISTEN_MAX + 1]; // Handed to the child as PASSED_FD_START onwards: listen sockets, then notify socket
+    int fd_count;
+    char *listen_pid;    // Where the child writes its PID for LISTEN_PID, NULL without listen sockets
+    const cpu_set_t *affinity; // CPUs to run on, NULL to inherit ours
+    int memory_node;     // NUMA node to prefer for memory, -1 for none
+    int nice;            // Priorities to set before exec, each 0 to inherit ours
+    int sched_policy;
+    int sched_priority;
+    int ioprio;
+    const char *oom_score_adj; // As written to /proc/self/oom_score_adj, NULL to inherit ours
+    int exec_errno;      // Set by the child if exec fails
+    int errno_fd;        // Without CLONE_VM, where the child writes exec_errno instead; -1 with it
+} SpawnRequest;
+
+int spawn_child(void *arg) {
+    SpawnRequest *req = arg;
+    sigset_t empty;
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, NULL); // Undo the supervisor's signalfd mask
+    if (req->cgroup_procs_fd >= 0) {
+        write(req->cgroup_procs_fd, "0", 1);
+    }
+    // Move every fd clear of the target range first, so none is overwritten
+    // before it has been copied to its place
+    if (req->errno_fd >= 0) {
+        req->errno_fd = fcntl(req->errno_fd, F_DUPFD_CLOEXEC, PASSED_FD_START + req->fd_count);
+    }
+    int moved[LISTEN_MAX + 1];
+    for (int k = 0; k < req->fd_count; k++) {
+        moved[k] = fcntl(req->fds[k], F_DUPFD_CLOEXEC, PASSED_FD_START + req->fd_count);
+    }
+    for (int k = 0; k < req->fd_count; k++) {
+        dup2(moved[k], PASSED_FD_START + k); // The copy does not inherit O_CLOEXEC
+    }
+#if INIT_PLACEMENT
+    if (req->affinity) {
+        sched_setaffinity(0, sizeof(cpu_set_t), req->affinity);
+    }
+    if (req->memory_node >= 0) {
+        unsigned long nodes = 1ul << req->memory_node;
+        syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodes, sizeof(nodes) * 8 + 1);
+    }
+#endif
+#if INIT_PRIORITIES
+    if (req->nice) {
+        setpriority(PRIO_PROCESS, 0, req->nice);
+    }
+    if (req->sched_policy != SCHED_OTHER) {
+        struct sched_param param = {.sched_priority = req->sched_priority};
+        sched_setscheduler(0, req->sched_policy, &param);
+    }
+    if (req->ioprio) {
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, req->ioprio);
+    }
+    if (req->oom_score_adj) {
+        int fd = open("/proc/self/oom_score_adj", O_WRONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            write(fd, req->oom_score_adj, strlen(req->oom_score_adj));
+            close(fd);
+        }
+    }
+#endif
+    if (req->listen_pid) {
+        char digits[16], *out = req->listen_pid;
+        int n = 0;
+        for (pid_t pid = getpid(); pid > 0; pid /= 10) digits[n++] = '0' + pid % 10;
+        while (n > 0) *out++ = digits[--n];
+        *out = '\0';
+    }
+    execve(req->path, req->argv, req->envp);
+    req->exec_errno = errno;
+    if (req->errno_fd >= 0) {
+        write(req->errno_fd, &req->exec_errno, sizeof(req->exec_errno));
+    }
+    _exit(127);
+}
+
+// A fork-style child has its own copy of req, so it reports a failed exec
+// over a close-on-exec pipe instead: EOF means the exec went through. As
+// with CLONE_VFORK, the parent waits for the exec or the exit.
+pid_t spawn_forked(SpawnRequest *req, pid_t (*spawn)(SpawnRequest *req)) {
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) < 0) return -1;
+    req->errno_fd = pipe_fds[1];
+    pid_t pid = spawn(req);
+    close(pipe_fds[1]);
+    req->errno_fd = -1;
+    if (pid > 0) {
+        ssize_t n;
+        do {
+            n = read(pipe_fds[0], &req->exec_errno, sizeof(req->exec_errno));
+        } while (n < 0 && errno == EINTR);
+        if (n != sizeof(req->exec_errno)) req->exec_errno = 0;
+    }
+    close(pipe_fds[0]);
+    return pid;
+}
+
+#if INIT_CGROUPS
+pid_t spawn_clone3(SpawnRequest *req) {
+    struct clone_args args = {.flags = CLONE_INTO_CGROUP, .exit_signal = SIGCHLD, .cgroup = req->cgroup_fd};
+    pid_t pid = syscall(SYS_clone3, &args, sizeof(args));
+    if (pid == 0) {
+        req->cgroup_procs_fd = -1; // Already in place
+        spawn_child(req);
+    }
+    return pid;
+}
+#endif
+
+pid_t spawn_fork(SpawnRequest *req) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        spawn_child(req);
+    }
+    return pid;
+}
+
+// Launch a child without copying the supervisor's page tables: with
+// CLONE_VM | CLONE_VFORK the child borrows our memory and we are suspended
+// until it execs or exits, so spawn cost does not grow with the size of the
+// service table. One static stack is enough since only one child can be in
+// spawn_child() at a time.
+//
+// The libc clone() wrapper cannot pass CLONE_INTO_CGROUP, so on this path the
+// child joins its cgroup with one write to the open cgroup.procs fd. Where
+// clone() is refused we fall back to a fork-style clone3(), which places the
+// child with CLONE_INTO_CGROUP, and finally to plain fork().
+pid_t spawn_process(SpawnRequest *req) {
+    static char stack[SPAWN_STACK_SIZE] __attribute__((aligned(16)));
+    req->exec_errno = 0;
+    req->errno_fd = -1;
+    pid_t pid = clone(spawn_child, stack + sizeof(stack), CLONE_VM | CLONE_VFORK | SIGCHLD, req);
+    if (pid >= 0 || (errno != ENOSYS && errno != EINVAL && errno != EPERM)) {
+        return pid;
+    }
+
+#if INIT_CGROUPS
+    if (req->cgroup_fd >= 0) {
+        pid = spawn_forked(req, spawn_clone3);
+        if (pid > 0) {
+            return pid;
+        }
+    }
+#endif
+    return spawn_forked(req, spawn_fork);
+}
+
+// The environment of a service that is passed fds or is an instance: ours
+// plus LISTEN_FDS and LISTEN_PID for its listen sockets, INIT_NOTIFY_FD for
+// its notify socket and INIT_INSTANCE and INIT_INSTANCES for an instance.
+// *listen_pid is pointed at the digits of LISTEN_PID for the child to fill in.
+char **service_environ(const ProcessConfig *cfg, bool notify, char **listen_pid) {
+    static char **env;
+    static int inherited;
+    static char listen_fds_var[32], listen_pid_var[32], notify_var[32], instance_var[32], instances_var[32];
+    if (!env) {
+        int n = 0;
+        while (environ[n]) n++;
+        env = xrealloc(NULL, (n + 6) * sizeof(char *));
+        for (int j = 0; j < n; j++) {
+            if (strncmp(environ[j], "INIT_NOTIFY_FD=", 15) != 0 && strncmp(environ[j], "INIT_INSTANCE", 13) != 0 &&
+                strncmp(environ[j], "LISTEN_", 7) != 0) {
+                env[inherited++] = environ[j];
+            }
+        }
+    }
+    int k = inherited;
+    *listen_pid = NULL;
+    if (cfg->listen_count) {
+        snprintf(listen_fds_var, sizeof(listen_fds_var), "LISTEN_FDS=%d", cfg->listen_count);
+        env[k++] = listen_fds_var;
+        strcpy(listen_pid_var, "LISTEN_PID=");
+        *listen_pid = listen_pid_var + strlen(listen_pid_var);
+        env[k++] = listen_pid_var;
+    }
+    if (notify) {
+        snprintf(notify_var, sizeof(notify_var), "INIT_NOTIFY_FD=%d", PASSED_FD_START + cfg->listen_count);
+        env[k++] = notify_var;
+    }
+    if (cfg->instances) {
+        snprintf(instance_var, sizeof(instance_var), "INIT_INSTANCE=%u", cfg->instance);
+        snprintf(instances_var, sizeof(instances_var), "INIT_INSTANCES=%u", cfg->instances);
+        env[k++] = instance_var;
+        env[k++] = instances_var;
+    }
+    env[k] = NULL;
+    return env;
+}
+
+#if INIT_PLACEMENT
+// The CPUs we may use and the NUMA nodes they belong to, read once at
+// startup for template instances and their pinning.
+cpu_set_t allowed_cpus;
+int *allowed_cpu_ids; // The allowed CPUs in ascending order
+int allowed_cpu_count = 0;
+int numa_nodes[MAX_NUMA_NODES]; // Online nodes with at least one allowed CPU
+cpu_set_t numa_node_cpus[MAX_NUMA_NODES];
+int numa_node_count = 0;
+
+// Parse a kernel CPU or node list such as "0-3,8" into a set.
+void parse_id_list(const char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+    while (*list >= '0' && *list <= '9') {
+        char *end;
+        long first = strtol(list, &end, 10), last = first;
+        if (*end == '-') last = strtol(end + 1, &end, 10);
+        for (long id = first; id <= last && id < CPU_SETSIZE; id++) CPU_SET(id, set);
+        list = *end == ',' ? end + 1 : end;
+    }
+}
+
+bool read_id_list(const char *path, cpu_set_t *set) {
+    char buf[1024];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    ssize_t n = fd >= 0 ? read(fd, buf, sizeof(buf) - 1) : -1;
+    if (fd >= 0) close(fd);
+    if (n <= 0) return false;
+    buf[n] = '\0';
+    parse_id_list(buf, set);
+    return true;
+}
+
+void topology_init() {
+    if (sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) < 0) {
+        CPU_ZERO(&allowed_cpus);
+        CPU_SET(0, &allowed_cpus);
+    }
+    allowed_cpu_ids = xrealloc(NULL, CPU_COUNT(&allowed_cpus) * sizeof(int));
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed_cpus)) allowed_cpu_ids[allowed_cpu_count++] = cpu;
+    }
+
+    cpu_set_t online, cpus;
+    if (!read_id_list("/sys/devices/system/node/online", &online)) return; // No NUMA
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (!CPU_ISSET(node, &online) || !read_id_list(path, &cpus)) continue;
+        CPU_AND(&numa_node_cpus[numa_node_count], &cpus, &allowed_cpus);
+        if (CPU_COUNT(&numa_node_cpus[numa_node_count]) > 0) numa_nodes[numa_node_count++] = node;
+    }
+}
+
+// Where a pinned instance runs: pin=cpu gives each instance one allowed CPU
+// and pin=node one NUMA node, its CPUs and a preference for its memory, both
+// wrapping around when there are more instances than CPUs or nodes.
+const cpu_set_t *service_placement(const ProcessConfig *cfg, cpu_set_t *cpus, int *memory_node) {
+    *memory_node = -1;
+    if (cfg->pin == PIN_CPU && allowed_cpu_count > 0) {
+        CPU_ZERO(cpus);
+        CPU_SET(allowed_cpu_ids[cfg->instance % allowed_cpu_count], cpus);
+        return cpus;
+    }
+    if (cfg->pin == PIN_NODE && numa_node_count > 0) {
+        int k = cfg->instance % numa_node_count;
+        *memory_node = numa_nodes[k];
+        return &numa_node_cpus[k];
+    }
+    return NULL;
+}
+#else
+void topology_init() {
+}
+
+const cpu_set_t *service_placement(const ProcessConfig *cfg, cpu_set_t *cpus, int *memory_node) {
+    (void)cfg;
+    (void)cpus;
+    *memory_node = -1;
+    return NULL;
+}
+#endif
+
+#if INIT_SOCKET_ACTIVATION
+// Bind one listen= address: an absolute path for a unix stream socket, or
+// [host:]port for TCP. The host is numeric, an IPv6 one in brackets; a port
+// alone listens on every IPv4 address.
+int listen_bind(const char *address) {
+    int fd = -1, saved;
+    if (address[0] == '/') {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        if (strlen(address) >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy(addr.sun_path, address);
+        struct stat st;
+        if (lstat(address, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            unlink(address); // Left behind by a previous boot
+        }
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0)) {
+            saved = errno;
+            close(fd);
+            errno = saved;
+            fd = -1;
+        }
+        return fd;
+    }
+
+    char host[64], port[16];
+    const char *colon = strrchr(address, ':');
+    const char *h = address;
+    size_t host_len = colon ? (size_t)(colon - address) : 0;
+    if (host_len >= 2 && address[0] == '[' && address[host_len - 1] == ']') {
+        h++;
+        host_len -= 2;
+    }
+    const char *p = colon ? colon + 1 : address;
+    if (host_len >= sizeof(host) || strlen(p) >= sizeof(port)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(host, h, host_len);
+    host[host_len] = '\0';
+    strcpy(port, p);
+    struct addrinfo hints = {.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV,
+                             .ai_family = host_len ? AF_UNSPEC : AF_INET,
+                             .ai_socktype = SOCK_STREAM};
+    struct addrinfo *ai;
+    if (getaddrinfo(host_len ? host : NULL, port, &hints, &ai) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    int one = 1;
+    fd = socket(ai->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+                    bind(fd, ai->ai_addr, ai->ai_addrlen) < 0 || listen(fd, SOMAXCONN) < 0)) {
+        saved = errno;
+        close(fd);
+        errno = saved;
+        fd = -1;
+    }
+    freeaddrinfo(ai);
+    return fd;
+}
+
+void listen_close(ProcessConfig *cfg) {
+    for (int k = 0; k < cfg->listen_count; k++) {
+        close(cfg->listen_fds[k]); // Also drops it from epoll
+    }
+    cfg->listen_count = 0;
+    cfg->listening = false;
+}
+
+// Bind all of a service's listen= addresses, or none of them.
+bool listen_setup(int i) {
+    ProcessConfig *cfg = &process_config[i];
+    char *addresses = strdup(arena_str(cfg->listen)), *save = NULL;
+    if (!addresses) return false;
+    for (char *address = strtok_r(addresses, " ", &save); address; address = strtok_r(NULL, " ", &save)) {
+        errno = E2BIG;
+        int fd = cfg->listen_count < LISTEN_MAX ? listen_bind(address) : -1;
+        if (fd < 0) {
+            log_event(LOG_ERROR, EV_LISTEN_FAILED, i, 0, errno, 0, address);
+            listen_close(cfg);
+            free(addresses);
+            return false;
+        }
+        cfg->listen_fds[cfg->listen_count++] = fd;
+    }
+    free(addresses);
+    return true;
+}
+
+// What to watch a service's sockets for: the first connection while it is
+// listening, and each new one while an idle= service runs. The service
+// accepts them itself, so the latter is edge-triggered.
+uint32_t listen_events(int i) {
+    if (processes[i].state == STATE_LISTENING) return EPOLLIN;
+    if (processes[i].pid > 0 && process_config[i].idle_ms) return EPOLLIN | EPOLLET;
+    return 0;
+}
+
+// Register a service's sockets for events, or unregister them for 0.
+void listen_watch(int i, uint32_t events) {
+    ProcessConfig *cfg = &process_config[i];
+    if (!events && !cfg->listening) return;
+    for (int k = 0; k < cfg->listen_count; k++) {
+        epoll_watch(events ? (cfg->listening ? EPOLL_CTL_MOD : EPOLL_CTL_ADD) : EPOLL_CTL_DEL, cfg->listen_fds[k],
+                    events, EVENT_LISTEN, i);
+    }
+    cfg->listening = events != 0;
+}
+#else
+// No service has listen= sockets
+void listen_close(ProcessConfig *cfg) {
+    (void)cfg;
+}
+
+bool listen_setup(int i) {
+    (void)i;
+    return false;
+}
+
+uint32_t listen_events(int i) {
+    (void)i;
+    return 0;
+}
+
+void listen_watch(int i, uint32_t events) {
+    (void)i;
+    (void)events;
+}
+#endif
+
+void start_process(int i) {
+    Process *p = &processes[i];
+    ProcessConfig *cfg = &process_config[i];
+    const char *path = arena_str(cfg->path);
+    if (p->pid > 0) {
+        // The previous instance has not been reaped yet; never run two
+        log_event(LOG_WARNING, EV_ALREADY_RUNNING, i, p->pid, 0, 0, NULL);
+        return;
+    }
+    if (!check_all_dependencies_active(i)) {
+        log_event(LOG_WARNING, EV_DEPS_UNSATISFIED, i, 0, 0, 0, NULL);
+        return;
+    }
+    if (cgroup_populated(cfg)) {
+        // Leftovers of its last run, or of an earlier supervisor's; never
+        // run two instances side by side
+        service_kill(i, SIGKILL);
+        listen_watch(i, 0);
+        cfg->start_when_empty = true; // See cgroup_events_read()
+        return;
+    }
+
+    // A datagram socketpair per service: messages keep their boundaries, our
+    // end never blocks, and it reads as EOF-free until the service exits
+    int sv[2] = {-1, -1};
+    if ((cfg->notify || cfg->watchdog_ms) &&
+        socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) < 0) {
+        perror("socketpair");
+    }
+
+    char instance[8];
+    snprintf(instance, sizeof(instance), "%u", cfg->instance);
+    char *argv[] = {(char *)path, cfg->instances ? instance : NULL, NULL};
+    char oom_score_adj[8];
+    snprintf(oom_score_adj, sizeof(oom_score_adj), "%d", cfg->oom_score_adj);
+    cpu_set_t cpus;
+    SpawnRequest req = {.path = path, .argv = argv, .cgroup_fd = cfg->cgroup_fd,
+                        .cgroup_procs_fd = cfg->cgroup_procs_fd, .envp = environ,
+                        .nice = cfg->nice, .sched_policy = cfg->sched_policy,
+                        .sched_priority = cfg->sched_priority, .ioprio = cfg->ioprio,
+                        .oom_score_adj = cfg->oom_score_adj ? oom_score_adj : NULL};
+    req.affinity = service_placement(cfg, &cpus, &req.memory_node);
+    for (int k = 0; k < cfg->listen_count; k++) {
+        req.fds[req.fd_count++] = cfg->listen_fds[k];
+    }
+    if (sv[1] >= 0) {
+        req.fds[req.fd_count++] = sv[1];
+    }
+    if (req.fd_count || cfg->instances) {
+        req.envp = service_environ(cfg, sv[1] >= 0, &req.listen_pid);
+    }
+    uint64_t spawn_started = monotonic_us();
+    pid_t pid = spawn_process(&req);
+    if (sv[1] >= 0) close(sv[1]);
+    if (pid < 0) {
+        if (sv[0] >= 0) close(sv[0]);
+        perror("clone");
+        log_message(LOG_ERROR, "Failed to fork process");
+        service_crashed(i); // Retried after the backoff like any crash
+        return;
+    }
+
+    trace_event(TRACE_SPAWN, spawn_started, i, pid, 0, -1);
+    trace_event(TRACE_EXEC, monotonic_us(), i, pid, req.exec_errno, -1);
+    if (req.exec_errno) {
+        // Never counted as having run. The child is already exiting, so it is
+        // reaped here: were its PID set until reap_children() got to it, a
+        // backoff that ended first would find the service still running.
+        if (sv[0] >= 0) close(sv[0]);
+        int status = 0;
+        waitpid(pid, &status, 0);
+        log_event(LOG_ERROR, EV_EXEC_FAILED, i, pid, req.exec_errno, 0, NULL);
+        log_event(LOG_INFO, EV_EXITED, i, pid, status, 0, NULL);
+        trace_event(TRACE_EXIT, monotonic_us(), i, pid, status, -1);
+        listen_watch(i, 0);
+        service_crashed(i);
+        return;
+    }
+
+    p->pid = pid;
+    pid_index_insert(pid, i);
+    cfg->active_at = monotonic_ms();
+    cfg->cpu_sampled = false;
+    cfg->idle_stopping = false;
+    listen_watch(i, cfg->idle_ms ? EPOLLIN | EPOLLET : 0); // The sockets are the service's from now on
+    cfg->start_time = spawn_started;
+    cfg->notify_fd = sv[0];
+    histogram_record(&spawn_latency, monotonic_us() - spawn_started);
+    log_event(LOG_INFO, EV_STARTED, i, pid, p->runlevel, 0, NULL);
+    if (cfg->notify_fd >= 0) {
+        watch_fd(cfg->notify_fd, EPOLLIN, EVENT_NOTIFY, i);
+    }
+    if (cfg->notify && cfg->notify_fd >= 0) {
+        set_state(i, STATE_STARTING); // mark_running() once READY=1 arrives
+        watch_alive(i, cfg->start_time / 1000 + START_TIMEOUT_MS);
+        return;
+    }
+    if (cfg->watchdog_ms) {
+        watch_alive(i, cfg->start_time / 1000 + cfg->watchdog_ms);
+    }
+    mark_running(i);
+}
+
+// Whether a service in this state satisfies its dependents. A listening
+// service does: connections queue on its sockets until it has started.
+bool state_up(uint8_t state) {
+    return state == STATE_RUNNING || state == STATE_LISTENING;
+}
+
+// Every state change goes through here so dependents' deps_down counters stay
+// exact. When a service comes up, any waiting dependent whose last missing
+// dependency it was is started on the spot.
+void set_state(int i, ServiceState state) {
+    bool was_running = state_up(processes[i].state);
+    processes[i].state = state;
+    if (was_running == state_up(state)) {
+        return;
+    }
+    if (!was_running) {
+        trace_event(TRACE_READY, monotonic_us(), i, processes[i].pid, 0, -1);
+    }
+
+    const ProcessConfig *cfg = &process_config[i];
+    for (uint32_t k = 0; k < cfg->dependent_count; k++) {
+        int j = dependent_ids[cfg->dependent_start + k];
+        if (!was_running) {
+            if (--process_config[j].deps_down == 0 && processes[j].state == STATE_WAITING) {
+                trace_event(TRACE_UNBLOCKED, monotonic_us(), j, 0, 0, i);
+                start_process(j);
+            }
+        } else {
+            process_config[j].deps_down++;
+        }
+    }
+}
+
+void mark_running(int i) {
+    histogram_record(&ready_latency, monotonic_us() - process_config[i].start_time);
+    set_state(i, STATE_RUNNING);
+}
+
+#if INIT_SOCKET_ACTIVATION
+// First connection on a listening service's sockets: start it. The
+// connection waits in the backlog until the service accepts it.
+void socket_activate(int i) {
+    log_event(LOG_INFO, EV_SOCKET_ACTIVATED, i, 0, 0, 0, NULL);
+    if (process_config[i].deps_down > 0) {
+        listen_watch(i, 0);
+        set_state(i, STATE_WAITING); // Started by set_state() once its dependencies are up
+        return;
+    }
+    start_process(i);
+}
+#endif
+
+// Move each service's dependencies from config_deps, where load_processes()
+// staged them, into dep_ids and index the reverse edges. Done once per load,
+// after the old graph has been diffed against. A service naming an unknown
+// dependency can never start and is marked failed.
+void resolve_dependencies() {
+    for (int i = 0; i < process_count; i++) {
+        ProcessConfig *cfg = &process_config[i];
+        uint32_t staged = cfg->dep_start, count = cfg->dep_count;
+        cfg->dep_start = dep_ids_count;
+        cfg->dep_count = 0;
+        for (uint32_t k = 0; k < count; k++) {
+            int id = config_deps[staged + k];
+            if (id < 0) {
+                log_event(LOG_ERROR, EV_UNKNOWN_DEPENDENCY, i, 0, 0, 0, arena_str(~id));
+                set_state(i, STATE_FAILED);
+                continue;
+            }
+            if (dep_ids_count == dep_ids_capacity) {
+                dep_ids_capacity = dep_ids_capacity ? dep_ids_capacity * 2 : 64;
+                dep_ids = xrealloc(dep_ids, dep_ids_capacity * sizeof(int));
+            }
+            dep_ids[dep_ids_count++] = id;
+            cfg->dep_count++;
+        }
+        cfg->deps_down = cfg->dep_count;
+        cfg->dependent_count = 0;
+    }
+
+    // Reverse every edge so state changes only visit actual dependents
+    for (uint32_t k = 0; k < dep_ids_count; k++) {
+        process_config[dep_ids[k]].dependent_count++;
+    }
+    uint32_t start = 0;
+    for (int i = 0; i < process_count; i++) {
+        process_config[i].dependent_start = start;
+        start += process_config[i].dependent_count;
+        process_config[i].dependent_count = 0;
+    }
+    dependent_ids = xrealloc(dependent_ids, (dep_ids_count ? dep_ids_count : 1) * sizeof(int));
+    for (int i = 0; i < process_count; i++) {
+        const ProcessConfig *cfg = &process_config[i];
+        for (uint32_t k = 0; k < cfg->dep_count; k++) {
+            ProcessConfig *dep = &process_config[dep_ids[cfg->dep_start + k]];
+            dependent_ids[dep->dependent_start + dep->dependent_count++] = i;
+        }
+    }
+}
+
+// Kahn's algorithm over the loaded runlevel. Services that are part of a
+// cycle can never start and are marked failed.
+void order_services() {
+    uint32_t *indegree = xrealloc(NULL, (process_count ? process_count : 1) * sizeof(uint32_t));
+    int ordered = 0;
+    for (int i = 0; i < process_count; i++) {
+        indegree[i] = process_config[i].dep_count;
+        if (indegree[i] == 0) {
+            boot_order[ordered++] = i;
+        }
+    }
+
+    // boot_order doubles as the work queue
+    for (int head = 0; head < ordered; head++) {
+        const ProcessConfig *cfg = &process_config[boot_order[head]];
+        for (uint32_t k = 0; k < cfg->dependent_count; k++) {
+            int j = dependent_ids[cfg->dependent_start + k];
+            if (--indegree[j] == 0) {
+                boot_order[ordered++] = j;
+            }
+        }
+    }
+
+    for (int i = 0; i < process_count; i++) {
+        if (indegree[i] > 0) {
+            log_event(LOG_ERROR, EV_DEPENDENCY_CYCLE, i, 0, 0, 0, NULL);
+            set_state(i, STATE_FAILED);
+        }
+    }
+    boot_count = ordered;
+    free(indegree);
+}
+
+// The inittab is never loaded straight from text. It is compiled into a
+// self-contained image: a ConfigImageHeader, the service records grouped by
+// runlevel, their dependencies already resolved to record indexes, then the
+// strings. The image is cached in CONFIG_CACHE, keyed by the inittab's inode,
+// size and mtime, so a boot or reload with an unchanged inittab maps the
+// cache and does no parsing at all. When the key misses, the inittab's hash
+// still lets a cache survive a touch or a copy of the same contents.
+#define CONFIG_CACHE_MAGIC "INITCFG1"
+#define CONFIG_DEP_UNKNOWN 0x80000000u // Dependency entry naming no service; the rest is its string offset
+
+typedef struct {
+    char magic[8];        // CONFIG_CACHE_MAGIC
+    uint32_t record_size; // sizeof(ConfigRecord), so a cache from another build is never used
+    uint32_t size;        // Total bytes
+    uint64_t hash;        // FNV-1a of the inittab it was compiled from
+    uint64_t source_ino;
+    uint64_t source_size;
+    int64_t source_mtime_ns; // 0 if the inittab was too new to trust its mtime
+    uint32_t count;          // Records following the header
+    uint32_t deps;           // Offset of the uint32_t dependency entries
+    uint32_t dep_count;
+    uint32_t strings;        // Offset of the NUL-terminated strings, which run to the end
+    uint32_t features;       // INIT_FEATURES of the build that compiled it, since options depend on them
+    uint32_t runlevel_start[MAX_RUNLEVELS]; // Each runlevel's records, in inittab order
+    uint32_t runlevel_count[MAX_RUNLEVELS];
+} ConfigImageHeader;
+
+typedef struct {
+    uint32_t command;      // String offsets
+    uint32_t path;         // The command without its @N template suffix
+    uint32_t dependencies; // As written, "" for none
+    uint32_t bad_options;  // Options this build does not know, space-separated, "" for none
+    uint32_t listen;       // listen= addresses, space-separated, "" for none
+    uint32_t dep_start;    // Entries deps[dep_start..+dep_count), record indexes within the runlevel
+    uint32_t dep_count;
+    int32_t memory_limit;
+    int32_t cpu_limit;
+    uint32_t watchdog_ms;
+    uint32_t idle_ms;
+    uint8_t runlevel;
+    uint8_t notify;
+    uint16_t instances;    // 0 for a plain service, else the count or INSTANCES_CPUS or INSTANCES_NODES
+    uint8_t pin;           // Pinning
+    uint8_t sched_policy;  // As in ProcessConfig
+    uint8_t sched_priority;
+    int8_t nice;
+    uint16_t ioprio;
+    int16_t oom_score_adj;
+} ConfigRecord;
+
+#define INSTANCES_CPUS 0xffff  // worker@cpus: one instance per CPU we may use
+#define INSTANCES_NODES 0xfffe // worker@nodes: one per NUMA node
+
+// A field of the mapped inittab, parsed in place
+typedef struct {
+    const char *s;
+    uint32_t len;
+} Span;
+
+typedef struct {
+    int runlevel;
+    Span command;
+    Span dependencies;
+    int memory_limit;
+    int cpu_limit;
+    Span options;
+} ConfigLine;
+
+typedef struct {
+    char *data;
+    uint32_t len;
+    uint32_t capacity;
+} Buffer;
+
+uint32_t buffer_append(Buffer *b, const void *data, uint32_t len) {
+    while (b->len + len > b->capacity) {
+        b->capacity = b->capacity ? b->capacity * 2 : 4096;
+        b->data = xrealloc(b->data, b->capacity);
+    }
+    uint32_t offset = b->len;
+    if (len) memcpy(b->data + offset, data, len);
+    b->len += len;
+    return offset;
+}
+
+uint32_t buffer_append_string(Buffer *b, Span s) {
+    uint32_t offset = buffer_append(b, s.s, s.len);
+    buffer_append(b, "", 1);
+    return offset;
+}
+
+// Add s to the space-separated string at *offset, which must be the last
+// string in b, or start one there.
+void buffer_join_string(Buffer *b, uint32_t *offset, Span s) {
+    if (*offset) {
+        b->len--; // Overwrite its NUL
+        buffer_append(b, " ", 1);
+        buffer_append_string(b, s);
+    } else {
+        *offset = buffer_append_string(b, s);
+    }
+}
+
+bool span_equals(Span s, const char *str) {
+    return strlen(str) == s.len && memcmp(s.s, str, s.len) == 0;
+}
+
+bool span_int(Span s, int *out) {
+    uint32_t k = s.len > 0 && s.s[0] == '-';
+    if (k == s.len) return false;
+    long long value = 0;
+    for (; k < s.len; k++) {
+        if (s.s[k] < '0' || s.s[k] > '9' || value > INT_MAX) return false;
+        value = value * 10 + (s.s[k] - '0');
+    }
+    if (value > INT_MAX) return false;
+    *out = s.s[0] == '-' ? -value : value;
+    return true;
+}
+
+// Cut the next blank-separated field off the front of *line.
+bool next_field(Span *line, Span *field) {
+    const char *p = line->s, *end = line->s + line->len;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    const char *start = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r') p++;
+    *field = (Span){start, p - start};
+    *line = (Span){p, end - p};
+    return field->len > 0;
+}
+
+// If opt is key=value, point value at the value.
+bool option_value(Span opt, const char *key, Span *value) {
+    uint32_t len = strlen(key);
+    if (opt.len <= len || opt.s[len] != '=' || memcmp(opt.s, key, len) != 0) return false;
+    *value = (Span){opt.s + len + 1, opt.len - len - 1};
+    return true;
+}
+
+// If value is name:N, parse N.
+bool option_class(Span value, const char *name, int *level) {
+    uint32_t len = strlen(name);
+    if (value.len <= len + 1 || value.s[len] != ':' || memcmp(value.s, name, len) != 0) return false;
+    return span_int((Span){value.s + len + 1, value.len - len - 1}, level);
+}
+
+// Trailing key=value options of an inittab line:
+//   ready=notify    the service is running once it sends READY=1
+//   watchdog=SECS   it must send WATCHDOG=1 at least this often
+//   listen=ADDR     bind ADDR (a unix socket path or [host:]port) and start
+//                   the service on its first connection; up to LISTEN_MAX
+//   idle=SECS       stop a listen= service idle this long, until the next
+//                   connection
+//   pin=cpu|node    place each instance of a template on its own CPU or
+//                   NUMA node
+//   nice=N          nice value, -20 to 19
+//   sched=POLICY    fifo:PRIO or rr:PRIO (1 to 99), batch or idle
+//   ioprio=CLASS    I/O priority: rt:LEVEL or be:LEVEL (0 to 7), or idle
+//   oom_score_adj=N -1000 to 1000
+// Only the options of features this build has (see init_config.h) parse.
+bool parse_option(ConfigRecord *rec, Span opt) {
+    Span value;
+    int n;
+    if (option_value(opt, "ready", &value) && span_equals(value, "notify")) {
+        rec->notify = 1;
+    } else if (option_value(opt, "watchdog", &value) && span_int(value, &n) && n > 0) {
+        rec->watchdog_ms = n * 1000;
+#if INIT_SOCKET_ACTIVATION
+    } else if (option_value(opt, "idle", &value) && span_int(value, &n) && n > 0) {
+        rec->idle_ms = n * 1000;
+    } else if (option_value(opt, "listen", &value) && value.len > 0) {
+        // Collected by compile_config()
+#endif
+#if INIT_PLACEMENT
+    } else if (option_value(opt, "pin", &value) && (span_equals(value, "cpu") || span_equals(value, "node"))) {
+        rec->pin = value.s[0] == 'c' ? PIN_CPU : PIN_NODE;
+#endif
+#if INIT_PRIORITIES
+    } else if (option_value(opt, "nice", &value) && span_int(value, &n) && n >= -20 && n <= 19) {
+        rec->nice = n;
+    } else if (option_value(opt, "sched", &value)) {
+        if (option_class(value, "fifo", &n) && n >= 1 && n <= 99) {
+            rec->sched_policy = SCHED_FIFO;
+        } else if (option_class(value, "rr", &n) && n >= 1 && n <= 99) {
+            rec->sched_policy = SCHED_RR;
+        } else if (span_equals(value, "batch")) {
+            rec->sched_policy = SCHED_BATCH;
+        } else if (span_equals(value, "idle")) {
+            rec->sched_policy = SCHED_IDLE;
+        } else {
+            return false;
+        }
+        rec->sched_priority = rec->sched_policy == SCHED_FIFO || rec->sched_policy == SCHED_RR ? n : 0;
+    } else if (option_value(opt, "ioprio", &value)) {
+        if (option_class(value, "rt", &n) && n >= 0 && n <= 7) {
+            rec->ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_RT, n);
+        } else if (option_class(value, "be", &n) && n >= 0 && n <= 7) {
+            rec->ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, n);
+        } else if (span_equals(value, "idle")) {
+            rec->ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0);
+        } else {
+            return false;
+        }
+    } else if (option_value(opt, "oom_score_adj", &value) && span_int(value, &n) && n >= -1000 && n <= 1000) {
+        rec->oom_score_adj = n;
+#endif
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Each line is "runlevel command dependencies memory_limit cpu_limit
+// [options]", with dependencies a comma-separated list or "-" for none.
+bool parse_config_line(Span line, ConfigLine *out) {
+    Span runlevel, memory_limit, cpu_limit;
+    if (line.len == 0 || line.s[0] == '#') return false;
+    if (!next_field(&line, &runlevel) || !span_int(runlevel, &out->runlevel) || !next_field(&line, &out->command) ||
+        !next_field(&line, &out->dependencies) || !next_field(&line, &memory_limit) ||
+        !span_int(memory_limit, &out->memory_limit) || !next_field(&line, &cpu_limit) ||
+        !span_int(cpu_limit, &out->cpu_limit)) {
+        return false;
+    }
+    if (out->runlevel < 0 || out->runlevel >= MAX_RUNLEVELS) return false;
+    if (out->dependencies.len == 1 && out->dependencies.s[0] == '-') out->dependencies.len = 0;
+    out->options = line;
+    return true;
+}
+
+// Slot of name in the open-addressed command table of the runlevel being
+// compiled: either free (-1) or the first record with that command, or that
+// template path.
+uint32_t compile_lookup(const int *ids, uint32_t mask, const ConfigRecord *records, const Buffer *strings, Span name) {
+    uint32_t h = hash_bytes(name.s, name.len) & mask;
+    while (ids[h] >= 0) {
+        const ConfigRecord *rec = &records[ids[h]];
+        if (span_equals(name, strings->data + rec->command) ||
+            (rec->instances && span_equals(name, strings->data + rec->path))) {
+            break;
+        }
+        h = (h + 1) & mask;
+    }
+    return h;
+}
+
+// Compile the text of an inittab into a malloc'ed image. Lines that do not
+// parse are skipped. Duplicate services and unknown options and dependencies
+// are kept in the image for load_image() to report on every load.
+char *compile_config(const char *text, size_t len) {
+    ConfigLine *lines = NULL;
+    uint32_t line_count = 0, line_capacity = 0;
+    const char *end = text + len;
+    for (const char *p = text; p < end;) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+        ConfigLine line;
+        if (parse_config_line((Span){p, eol - p}, &line)) {
+            if (line_count == line_capacity) {
+                line_capacity = line_capacity ? line_capacity * 2 : 64;
+                lines = xrealloc(lines, line_capacity * sizeof(ConfigLine));
+            }
+            lines[line_count++] = line;
+        }
+        p = eol < end ? eol + 1 : end;
+    }
+
+    ConfigImageHeader header = {.record_size = sizeof(ConfigRecord), .count = line_count, .features = INIT_FEATURES};
+    memcpy(header.magic, CONFIG_CACHE_MAGIC, sizeof(header.magic));
+    ConfigRecord *records = xrealloc(NULL, (line_count ? line_count : 1) * sizeof(ConfigRecord));
+    Buffer deps = {0}, strings = {0};
+    buffer_append(&strings, "", 1); // Offset 0 is the empty string
+    uint32_t capacity = 64;
+    while (capacity < line_count * 4) capacity *= 2; // Templates take two entries
+    int *ids = xrealloc(NULL, capacity * sizeof(int));
+
+    uint32_t count = 0;
+    for (int r = 0; r < MAX_RUNLEVELS; r++) {
+        uint32_t start = header.runlevel_start[r] = count;
+        memset(ids, 0xff, capacity * sizeof(int)); // All -1
+        for (uint32_t n = 0; n < line_count; n++) {
+            const ConfigLine *line = &lines[n];
+            if (line->runlevel != r) continue;
+            ConfigRecord *rec = &records[count];
+            // command@N, @cpus or @nodes is a template; anything else after an @ is just part of the name
+            Span path = line->command, suffix = {0};
+            for (uint32_t c = path.len; c > 1; c--) {
+                if (path.s[c - 1] == '@') {
+                    suffix = (Span){path.s + c, path.len - c};
+                    path.len = c - 1;
+                    break;
+                }
+            }
+            int instances = 0;
+            if (INIT_PLACEMENT && span_equals(suffix, "cpus")) {
+                instances = INSTANCES_CPUS;
+            } else if (INIT_PLACEMENT && span_equals(suffix, "nodes")) {
+                instances = INSTANCES_NODES;
+            } else if (!span_int(suffix, &instances) || instances < 1 || instances > MAX_INSTANCES) {
+                instances = 0;
+                path = line->command;
+            }
+            *rec = (ConfigRecord){
+                .command = buffer_append_string(&strings, line->command),
+                .path = buffer_append_string(&strings, path),
+                .instances = instances,
+                .dependencies = buffer_append_string(&strings, line->dependencies),
+                .memory_limit = line->memory_limit,
+                .cpu_limit = line->cpu_limit,
+                .runlevel = r,
+            };
+            Span options = line->options, opt;
+            while (next_field(&options, &opt)) {
+                if (!parse_option(rec, opt)) buffer_join_string(&strings, &rec->bad_options, opt);
+            }
+#if INIT_SOCKET_ACTIVATION
+            for (options = line->options; next_field(&options, &opt);) {
+                Span value;
+                if (option_value(opt, "listen", &value) && value.len > 0) {
+                    buffer_join_string(&strings, &rec->listen, value);
+                }
+            }
+#endif
+            uint32_t h = compile_lookup(ids, capacity - 1, records, &strings, line->command);
+            if (ids[h] < 0) ids[h] = count;
+            if (instances) { // Dependents may also name a template by its path
+                h = compile_lookup(ids, capacity - 1, records, &strings, path);
+                if (ids[h] < 0) ids[h] = count;
+            }
+            count++;
+        }
+        header.runlevel_count[r] = count - start;
+
+        // Every record of the runlevel is known now, so forward references resolve
+        for (uint32_t n = 0, k = start; n < line_count; n++) {
+            if (lines[n].runlevel != r) continue;
+            ConfigRecord *rec = &records[k++];
+            rec->dep_start = deps.len / sizeof(uint32_t);
+            const char *p = lines[n].dependencies.s, *list_end = p + lines[n].dependencies.len;
+            while (p < list_end) {
+                const char *comma = memchr(p, ',', list_end - p);
+                if (!comma) comma = list_end;
+                Span dep = {p, comma - p};
+                p = comma < list_end ? comma + 1 : list_end;
+                if (dep.len == 0) continue;
+                int id = ids[compile_lookup(ids, capacity - 1, records, &strings, dep)];
+                uint32_t entry = id >= 0 ? (uint32_t)(id - start) : CONFIG_DEP_UNKNOWN | buffer_append_string(&strings, dep);
+                bool listed = false; // Twice in the same list
+                for (uint32_t d = 0; d < rec->dep_count && id >= 0; d++) {
+                    listed |= ((uint32_t *)deps.data)[rec->dep_start + d] == entry;
+                }
+                if (!listed) {
+                    buffer_append(&deps, &entry, sizeof(entry));
+                    rec->dep_count++;
+                }
+            }
+        }
+    }
 
-typedef struct {
-    pid_t pid;
-    char command[256];
-    int runlevel;
-    bool active;
-} Process;
+    header.deps = sizeof(header) + count * sizeof(ConfigRecord);
+    header.dep_count = deps.len / sizeof(uint32_t);
+    header.strings = header.deps + deps.len;
+    header.size = header.strings + strings.len;
+    char *image = xrealloc(NULL, header.size);
+    memcpy(image, &header, sizeof(header));
+    memcpy(image + sizeof(header), records, count * sizeof(ConfigRecord));
+    if (deps.len) memcpy(image + header.deps, deps.data, deps.len);
+    memcpy(image + header.strings, strings.data, strings.len);
+    free(lines);
+    free(records);
+    free(deps.data);
+    free(strings.data);
+    free(ids);
+    return image;
+}
 
-Process processes[MAX_PROCESSES];
-int process_count = 0;
-int current_runlevel = 0;
+#if INIT_CONFIG_CACHE
+// A cache is only used if this build wrote it and every offset in it stays
+// inside it; anything else is recompiled.
+bool config_image_valid(const char *image, size_t size) {
+    const ConfigImageHeader *h = (const ConfigImageHeader *)image;
+    if (size < sizeof(*h) || memcmp(h->magic, CONFIG_CACHE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->record_size != sizeof(ConfigRecord) || h->features != INIT_FEATURES || h->size != size || image[size - 1] != '\0' ||
+        h->count > (size - sizeof(*h)) / sizeof(ConfigRecord) || h->deps != sizeof(*h) + h->count * sizeof(ConfigRecord) ||
+        h->dep_count > (size - h->deps) / sizeof(uint32_t) || h->strings != h->deps + h->dep_count * sizeof(uint32_t)) {
+        return false;
+    }
+    uint32_t strings_len = size - h->strings;
+    const ConfigRecord *records = (const ConfigRecord *)(image + sizeof(*h));
+    const uint32_t *deps = (const uint32_t *)(image + h->deps);
+    for (int r = 0; r < MAX_RUNLEVELS; r++) {
+        uint32_t start = h->runlevel_start[r], count = h->runlevel_count[r];
+        if (start > h->count || count > h->count - start) return false;
+        for (uint32_t k = start; k < start + count; k++) {
+            const ConfigRecord *rec = &records[k];
+            if (rec->runlevel != r || rec->command >= strings_len || rec->dependencies >= strings_len ||
+                rec->path >= strings_len || rec->bad_options >= strings_len || rec->listen >= strings_len || rec->dep_start > h->dep_count ||
+                rec->dep_count > h->dep_count - rec->dep_start) {
+                return false;
+            }
+            for (uint32_t d = 0; d < rec->dep_count; d++) {
+                uint32_t entry = deps[rec->dep_start + d];
+                if (entry & CONFIG_DEP_UNKNOWN ? (entry & ~CONFIG_DEP_UNKNOWN) >= strings_len : entry >= count) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Map the cached image privately, so its key can be updated in memory.
+char *config_cache_map(size_t *size) {
+    int fd = open(config_cache, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    char *image = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(ConfigImageHeader) && st.st_size < UINT32_MAX) {
+        image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (image == MAP_FAILED) {
+            image = NULL;
+        } else if (!config_image_valid(image, st.st_size)) {
+            munmap(image, st.st_size);
+            image = NULL;
+        }
+    }
+    close(fd);
+    *size = st.st_size;
+    return image;
+}
 
-void log_message(const char *message) {
-    FILE *log_file = fopen(LOG_FILE, "a");
-    if (log_file) {
-        fprintf(log_file, "%s\n", message);
-        fclose(log_file);
+// Replace the cache atomically. Failing is harmless, e.g. on a read-only
+// root: the next load just compiles the inittab again.
+void config_cache_write(const char *image, uint32_t size) {
+    mkdir(config_cache_dir, 0755);
+    int fd = open(config_cache_tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    bool written = write(fd, image, size) == (ssize_t)size;
+    close(fd);
+    if (!written || rename(config_cache_tmp, config_cache) < 0) {
+        unlink(config_cache_tmp);
     }
 }
 
-void handle_signal(int sig) {
-    if (sig == SIGCHLD) {
-        // Reap all dead children
-        while (1) {
-            pid_t pid = waitpid(-1, NULL, WNOHANG);
-            if (pid <= 0) break;
+// Key an image to the inittab it was compiled from. An mtime from the last
+// two seconds is not recorded: the file could still be rewritten within the
+// same timestamp tick, and only its hash can tell.
+void config_image_key(ConfigImageHeader *h, const struct stat *st, uint64_t hash) {
+    int64_t mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+    h->hash = hash;
+    h->source_ino = st->st_ino;
+    h->source_size = st->st_size;
+    h->source_mtime_ns = (int64_t)realtime_ns() - mtime_ns < 2000000000 ? 0 : mtime_ns;
+}
+#endif
 
-            for (int i = 0; i < process_count; i++) {
-                if (processes[i].pid == pid) {
-                    char log_msg[512];
-                    snprintf(log_msg, sizeof(log_msg), "Process %s (PID %d) finished", processes[i].command, pid);
-                    log_message(log_msg);
-                    processes[i].active = false; // Mark as inactive
-                    break;
+uint32_t template_instances(const ConfigRecord *rec) {
+#if INIT_PLACEMENT
+    if (rec->instances == INSTANCES_CPUS) return allowed_cpu_count;
+    if (rec->instances == INSTANCES_NODES) return numa_node_count ? numa_node_count : 1;
+#endif
+    return rec->instances;
+}
+
+void config_deps_push(int dep) {
+    if (config_deps_count == config_deps_capacity) {
+        config_deps_capacity = config_deps_capacity ? config_deps_capacity * 2 : 64;
+        config_deps = xrealloc(config_deps, config_deps_capacity * sizeof(int));
+    }
+    config_deps[config_deps_count++] = dep;
+}
+
+// Fill the table with the current runlevel's services from an image. A
+// template is expanded here rather than when compiling, since @cpus and
+// @nodes depend on the machine: worker@4 becomes worker@0 to worker@3, each
+// an ordinary service, and a dependency on the template is one on all of
+// them. Dependencies are staged in config_deps as table slots, or as the
+// complement of the arena offset of a name nothing answers to, for
+// resolve_dependencies() to move into dep_ids once the old graph has been
+// diffed against.
+void load_image(const char *image) {
+    const ConfigImageHeader *h = (const ConfigImageHeader *)image;
+    const ConfigRecord *records = (const ConfigRecord *)(image + sizeof(*h)) + h->runlevel_start[current_runlevel];
+    const uint32_t *deps = (const uint32_t *)(image + h->deps);
+    const char *strings = image + h->strings;
+    uint32_t count = h->runlevel_count[current_runlevel];
+    int *first = xrealloc(NULL, (count ? count : 1) * 2 * sizeof(int));
+    int *slots = first + count; // Each record's slots are first[k]..+slots[k]
+
+    for (uint32_t k = 0; k < count; k++) {
+        const ConfigRecord *rec = &records[k];
+        uint32_t instances = template_instances(rec);
+        first[k] = process_count;
+        for (uint32_t n = 0; n < (instances ? instances : 1); n++) {
+            char name[512];
+            snprintf(name, sizeof(name), "%s@%u", strings + rec->path, n);
+            int i = add_service();
+            processes[i] = (Process){0, STATE_WAITING, rec->runlevel, 0};
+            process_config[i] = (ProcessConfig){
+                .command = intern_string(instances ? name : strings + rec->command),
+                .path = intern_string(strings + rec->path),
+                .instance = n,
+                .instances = instances,
+                .pin = rec->pin,
+                .sched_policy = rec->sched_policy,
+                .sched_priority = rec->sched_priority,
+                .nice = rec->nice,
+                .ioprio = rec->ioprio,
+                .oom_score_adj = rec->oom_score_adj,
+                .dependencies = intern_string(strings + rec->dependencies),
+                .notify_fd = -1,
+                .memory_limit = rec->memory_limit,
+                .cpu_limit = rec->cpu_limit,
+                .notify = rec->notify,
+                .watchdog_ms = rec->watchdog_ms,
+                .listen = intern_string(strings + rec->listen),
+                .idle_ms = rec->listen ? rec->idle_ms : 0,
+                .cgroup_fd = -1,
+                .cgroup_procs_fd = -1,
+                .memory_events_fd = -1,
+                .cgroup_events_fd = -1,
+                .memory_pressure_fd = -1,
+                .cpu_stat_fd = -1,
+            };
+            if (n == 0 && rec->bad_options) {
+                log_event(LOG_WARNING, EV_BAD_OPTION, i, 0, 0, 0, strings + rec->bad_options);
+            }
+            if (n == 0 && rec->idle_ms && !rec->listen) {
+                log_event(LOG_WARNING, EV_BAD_OPTION, i, 0, 0, 0, "idle= without listen=");
+            }
+            if (n == 0 && rec->pin && !rec->instances) {
+                log_event(LOG_WARNING, EV_BAD_OPTION, i, 0, 0, 0, "pin= without a template");
+            }
+            if (rec->listen && rec->instances) {
+                if (n == 0) log_event(LOG_WARNING, EV_BAD_OPTION, i, 0, 0, 0, "listen= on a template");
+                process_config[i].listen = 0; // Instances cannot share one set of sockets
+                process_config[i].idle_ms = 0;
+            }
+            if (!register_service(i)) {
+                log_event(LOG_WARNING, EV_DUPLICATE_SERVICE, -1, 0, 0, 0, service_command(i));
+                process_count--; // Always the last slot, so every record's slots stay contiguous
+            }
+        }
+        slots[k] = process_count - first[k];
+    }
+
+    config_deps_count = 0;
+    for (uint32_t k = 0; k < count; k++) {
+        const ConfigRecord *rec = &records[k];
+        for (int i = first[k]; i < first[k] + slots[k]; i++) {
+            ProcessConfig *cfg = &process_config[i];
+            cfg->dep_start = config_deps_count;
+            for (uint32_t d = 0; d < rec->dep_count; d++) {
+                uint32_t entry = deps[rec->dep_start + d];
+                if (entry & CONFIG_DEP_UNKNOWN) {
+                    config_deps_push(~(int)intern_string(strings + (entry & ~CONFIG_DEP_UNKNOWN)));
+                    continue;
+                }
+                for (int j = first[entry]; j < first[entry] + slots[entry]; j++) {
+                    config_deps_push(j);
                 }
             }
+            cfg->dep_count = config_deps_count - cfg->dep_start;
         }
     }
+    free(first);
 }
 
-void start_process(const char *command, int runlevel) {
-    if (process_count >= MAX_PROCESSES) {
-        log_message("Max processes reached");
+// Load the whole runlevel into the table before anything is started, so a
+// dependency listed later in the file than its dependent is still honoured.
+// The inittab is mapped and tokenized in place; only a changed one is parsed.
+void load_processes() {
+    if (shutting_down) return; // Nothing is part of the empty runlevel
+    int fd = open(config_file, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror("Could not open configuration file");
+        log_message(LOG_ERROR, "Could not open configuration file");
+        if (fd >= 0) close(fd);
         return;
     }
 
-    pid_t pid = fork();
-    if (pid < 0) {
-        perror("fork");
-        log_message("Failed to fork process");
+#if INIT_CONFIG_CACHE
+    size_t cache_size = 0;
+    char *cache = config_cache_map(&cache_size);
+    ConfigImageHeader *cached = (ConfigImageHeader *)cache;
+    int64_t mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    if (cache && cached->source_mtime_ns == mtime_ns && mtime_ns != 0 && cached->source_ino == (uint64_t)st.st_ino &&
+        cached->source_size == (uint64_t)st.st_size) {
+        close(fd);
+        load_image(cache);
+        munmap(cache, cache_size);
         return;
     }
+#endif
 
-    if (pid == 0) {
-        // Child process
-        execl(command, command, NULL);
-        perror("execl");
-        exit(EXIT_FAILURE);
+    char *text = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (text == MAP_FAILED) {
+        perror("Could not map configuration file");
+        log_message(LOG_ERROR, "Could not map configuration file");
+#if INIT_CONFIG_CACHE
+        if (cache) munmap(cache, cache_size);
+#endif
+        return;
+    }
+#if INIT_CONFIG_CACHE
+    uint64_t hash = hash_bytes(text ? text : "", st.st_size);
+    if (cache && cached->hash == hash && cached->source_size == (uint64_t)st.st_size) {
+        config_image_key(cached, &st, hash); // Same contents, new key
+        config_cache_write(cache, cache_size);
+        load_image(cache);
+    } else {
+        char *image = compile_config(text ? text : "", st.st_size);
+        config_image_key((ConfigImageHeader *)image, &st, hash);
+        config_cache_write(image, ((ConfigImageHeader *)image)->size);
+        load_image(image);
+        free(image);
+    }
+    if (cache) munmap(cache, cache_size);
+#else
+    char *image = compile_config(text ? text : "", st.st_size);
+    load_image(image);
+    free(image);
+#endif
+    if (text) munmap(text, st.st_size);
+}
+
+// Bring a service loaded into slot i up to date with the live instance of the
+// same command from the previous table: it keeps its process, cgroup and
+// restart history. Returns what about it changed, NULL if nothing did.
+const char *adopt_service(int i, const Process *old, const ProcessConfig *old_cfg) {
+    Process *p = &processes[i];
+    ProcessConfig *cfg = &process_config[i];
+    p->pid = old->pid;
+    p->state = old->state;
+    p->restart_count = old->restart_count;
+    cfg->notify_fd = old_cfg->notify_fd;
+    cfg->start_time = old_cfg->start_time;
+    cfg->crash_window_start = old_cfg->crash_window_start;
+    cfg->restart_at = old_cfg->restart_at;
+    cfg->stop_started = old_cfg->stop_started;
+    cfg->kill_at = old_cfg->kill_at;
+    cfg->stop_ms = old_cfg->stop_ms;
+    cfg->stop_killed = old_cfg->stop_killed;
+    cfg->restarts_total = old_cfg->restarts_total;
+    cfg->alive_at = old_cfg->alive_at;
+    cfg->cgroup_fd = old_cfg->cgroup_fd;
+    cfg->cgroup_procs_fd = old_cfg->cgroup_procs_fd;
+    cfg->memory_events_fd = old_cfg->memory_events_fd;
+    cfg->cgroup_events_fd = old_cfg->cgroup_events_fd;
+    cfg->start_when_empty = old_cfg->start_when_empty;
+    cfg->memory_pressure_fd = old_cfg->memory_pressure_fd;
+    cfg->memory_high = old_cfg->memory_high;
+    cfg->memory_max = old_cfg->memory_max;
+    cfg->memory_oom_kill = old_cfg->memory_oom_kill;
+    cfg->active_at = old_cfg->active_at;
+    cfg->cpu_usage = old_cfg->cpu_usage;
+    cfg->cpu_sampled = old_cfg->cpu_sampled;
+    cfg->cpu_stat_fd = old_cfg->cpu_stat_fd;
+    if (cfg->listen == old_cfg->listen) {
+        memcpy(cfg->listen_fds, old_cfg->listen_fds, sizeof(cfg->listen_fds));
+        cfg->listen_count = old_cfg->listen_count;
+        cfg->listening = old_cfg->listening;
+        cfg->idle_stopping = old_cfg->idle_stopping;
     } else {
-        // Parent process
-        processes[process_count++] = (Process){pid, "", runlevel, true};
-        strncpy(processes[process_count - 1].command, command, sizeof(processes[process_count - 1].command));
-        char log_msg[512];
-        snprintf(log_msg, sizeof(log_msg), "Started process: %s with PID: %d for runlevel: %d", command, pid, runlevel);
-        log_message(log_msg);
+        for (int k = 0; k < old_cfg->listen_count; k++) {
+            close(old_cfg->listen_fds[k]); // Rebound by init_processes()
+        }
+    }
+
+    if (p->state == STATE_FAILED && p->pid == 0) {
+        p->state = STATE_WAITING; // Reconsidered against the new graph
+    }
+    if (cfg->dependencies != old_cfg->dependencies) { // Interned, so equal strings share an offset
+        return "dependencies";
+    }
+    if (cfg->notify != old_cfg->notify || cfg->watchdog_ms != old_cfg->watchdog_ms) {
+        return "readiness options"; // The notify socket is set up at spawn
+    }
+    if (cfg->listen != old_cfg->listen) {
+        return "listen sockets";
+    }
+    if (cfg->pin != old_cfg->pin || cfg->instances != old_cfg->instances) {
+        return "placement"; // Applied at spawn, and INIT_INSTANCES changed
+    }
+    if (cfg->sched_policy != old_cfg->sched_policy || cfg->sched_priority != old_cfg->sched_priority ||
+        cfg->nice != old_cfg->nice || cfg->ioprio != old_cfg->ioprio || cfg->oom_score_adj != old_cfg->oom_score_adj) {
+        return "priorities"; // Applied at spawn, and inherited by everything the service has started since
+    }
+    if (cfg->memory_limit != old_cfg->memory_limit || cfg->cpu_limit != old_cfg->cpu_limit) {
+        return "resource limits";
+    }
+    return NULL;
+}
+
+// Keep a service dropped from the inittab in the table, unnamed, until it has
+// been stopped and reaped. A retired service's dep_ids list the retired
+// services it depended on, and its deps_down counts the retired dependents it
+// is waiting for: services are stopped in reverse dependency order, each as
+// soon as nothing still running depends on it.
+int retire_service(const Process *old, const ProcessConfig *old_cfg) {
+    int i = add_service();
+    processes[i] = *old;
+    process_config[i] = *old_cfg;
+    ProcessConfig *cfg = &process_config[i];
+    cfg->dependencies = 0;
+    cfg->dep_start = cfg->dep_count = cfg->dependent_start = cfg->dependent_count = cfg->deps_down = 0;
+    cfg->restart_at = 0;
+    listen_close(cfg); // Nothing will be started on them again
+    cfg->idle_stopping = false;
+    processes[i].state = STATE_STOPPING; // Signalled by signal_stop() once its dependents are gone
+    register_retired(i);
+    return i;
+}
+
+// A retired service was reaped: stop whatever it was holding back.
+void retired_service_stopped(int i) {
+    const ProcessConfig *cfg = &process_config[i];
+    for (uint32_t k = 0; k < cfg->dep_count; k++) {
+        int dep = dep_ids[cfg->dep_start + k];
+        if (--process_config[dep].deps_down == 0) {
+            signal_stop(dep);
+        }
     }
 }
 
+// Load the inittab for the current runlevel and reconcile it with whatever is
+// already running. Each service is matched to the live table by its command;
+// one that is unchanged keeps running untouched, so a reload or runlevel
+// switch only costs what actually changed: new services are started through
+// the parallel scheduler, departing ones stopped in parallel in reverse
+// dependency order, and those whose dependencies changed restarted. New
+// resource limits are applied in place. At boot the live table is empty and
+// this simply starts everything.
 void init_processes() {
-    FILE *config = fopen(CONFIG_FILE, "r");
-    if (!config) {
-        perror("Could not open configuration file");
-        log_message("Could not open configuration file");
-        return;
+    int old_count = process_count;
+    Process *old = xrealloc(NULL, (old_count ? old_count : 1) * sizeof(Process));
+    ProcessConfig *old_cfg = xrealloc(NULL, (old_count ? old_count : 1) * sizeof(ProcessConfig));
+    int *retired = xrealloc(NULL, (old_count ? old_count : 1) * sizeof(int));
+    memcpy(old, processes, old_count * sizeof(Process));
+    memcpy(old_cfg, process_config, old_count * sizeof(ProcessConfig));
+    int old_named = named_count;
+
+    process_count = 0;
+    clear_service_ids();
+    uint64_t load_started = monotonic_us();
+    load_processes();
+    int loaded = named_count = process_count;
+    uint64_t load_done = monotonic_us();
+    trace_event(TRACE_CONFIG_LOADED, load_done, -1, 0, load_done - load_started, -1);
+
+    const char **changed = xrealloc(NULL, (loaded ? loaded : 1) * sizeof(char *));
+    bool *adopted = xrealloc(NULL, (loaded ? loaded : 1) * sizeof(bool));
+    memset(changed, 0, loaded * sizeof(char *));
+    memset(adopted, 0, loaded * sizeof(bool));
+    for (int j = 0; j < old_count; j++) {
+        int i = j < old_named ? find_service(arena_str(old_cfg[j].command)) : -1;
+        retired[j] = -1;
+        if (i >= 0) {
+            changed[i] = adopt_service(i, &old[j], &old_cfg[j]);
+            adopted[i] = true;
+        } else if (old[j].pid > 0) {
+            retired[j] = retire_service(&old[j], &old_cfg[j]);
+        } else {
+            cgroup_release(&old_cfg[j]);
+            listen_close(&old_cfg[j]);
+        }
     }
 
-    char command[256];
-    int runlevel;
-    while (fgets(command, sizeof(command), config)) {
-        // Each line should have "runlevel command"
-        if (sscanf(command, "%d %[^\n]", &runlevel, command) == 2) {
-            if (runlevel == current_runlevel) {
-                start_process(command, runlevel);
+    // Stop edges between retired services come from the old graph, which
+    // resolve_dependencies() is about to overwrite: (dependent, dependency)
+    // pairs, grouped by dependent.
+    int *stop_edges = xrealloc(NULL, (dep_ids_capacity ? dep_ids_capacity : 1) * 2 * sizeof(int));
+    uint32_t stop_edge_count = 0;
+    for (int j = 0; j < old_count; j++) {
+        if (retired[j] < 0) continue;
+        for (uint32_t k = 0; k < old_cfg[j].dep_count; k++) {
+            int dep = retired[dep_ids[old_cfg[j].dep_start + k]];
+            if (dep >= 0) {
+                stop_edges[2 * stop_edge_count] = retired[j];
+                stop_edges[2 * stop_edge_count + 1] = dep;
+                stop_edge_count++;
+            }
+        }
+    }
+
+    if (log_binary) {
+        for (int i = 0; i < process_count; i++) {
+            log_event(LOG_INFO, EV_SERVICE_NAME, i, 0, 0, 0, service_command(i));
+        }
+    }
+    for (int i = loaded; i < process_count && !shutting_down; i++) {
+        log_event(LOG_INFO, EV_SERVICE_REMOVED, i, processes[i].pid, 0, 0, NULL);
+    }
+    resolve_dependencies();
+    order_services();
+
+    // Sockets are bound before deps_down is counted below, since a listening
+    // service already satisfies its dependents. States change directly here
+    // for the same reason: the counters are rebuilt from them in a moment.
+    for (int i = 0; i < loaded; i++) {
+        ProcessConfig *cfg = &process_config[i];
+        Process *p = &processes[i];
+        if (!cfg->listen) {
+            if (p->state == STATE_LISTENING) p->state = STATE_WAITING; // No longer socket activated
+            continue;
+        }
+        if (p->state == STATE_FAILED || (cfg->listen_count == 0 && !listen_setup(i))) {
+            if (p->pid == 0) p->state = STATE_FAILED;
+            continue;
+        }
+        if (p->state == STATE_WAITING && p->pid == 0) {
+            p->state = STATE_LISTENING;
+            log_event(LOG_INFO, EV_LISTENING, i, 0, cfg->listen_count, 0, NULL);
+        }
+    }
+
+    // Slots moved, so everything keyed by slot is rebuilt from the new table
+    pid_index_clear();
+    service_timers_count = 0;
+    for (int i = 0; i < process_count; i++) {
+        ProcessConfig *cfg = &process_config[i];
+        uint32_t down = 0;
+        for (uint32_t k = 0; k < cfg->dep_count; k++) {
+            down += !state_up(processes[dep_ids[cfg->dep_start + k]].state);
+        }
+        cfg->deps_down = down;
+        if (processes[i].pid > 0) {
+            pid_index_insert(processes[i].pid, i);
+            if (processes[i].state == STATE_FAILED) {
+                signal_stop(i); // Its new dependency graph is broken
+            }
+        }
+        if (cfg->restart_at) {
+            service_timer_push(cfg->restart_at, i);
+        }
+        if (cfg->kill_at) {
+            service_timer_push(cfg->kill_at, i);
+        }
+        cfg->alive_timer = 0;
+        watch_alive(i, cfg->alive_at);
+        if (cfg->notify_fd >= 0) {
+            rewatch_fd(cfg->notify_fd, EPOLLIN, EVENT_NOTIFY, i);
+        }
+        if (cfg->memory_events_fd >= 0) {
+            rewatch_fd(cfg->memory_events_fd, EPOLLPRI, EVENT_MEMORY_EVENTS, i);
+        }
+        if (cfg->cgroup_events_fd >= 0) {
+            rewatch_fd(cfg->cgroup_events_fd, EPOLLPRI, EVENT_CGROUP_EVENTS, i);
+        }
+        if (cfg->memory_pressure_fd >= 0) {
+            rewatch_fd(cfg->memory_pressure_fd, EPOLLPRI, EVENT_MEMORY_PRESSURE, i);
+        }
+        listen_watch(i, listen_events(i));
+    }
+    service_timer_arm();
+
+    for (uint32_t k = 0; k < stop_edge_count; k++) {
+        ProcessConfig *cfg = &process_config[stop_edges[2 * k]];
+        if (cfg->dep_count == 0) {
+            cfg->dep_start = dep_ids_count;
+        }
+        if (dep_ids_count == dep_ids_capacity) {
+            dep_ids_capacity = dep_ids_capacity ? dep_ids_capacity * 2 : 64;
+            dep_ids = xrealloc(dep_ids, dep_ids_capacity * sizeof(int));
+        }
+        dep_ids[dep_ids_count++] = stop_edges[2 * k + 1];
+        cfg->dep_count++;
+        process_config[stop_edges[2 * k + 1]].deps_down++;
+    }
+    for (int i = loaded; i < process_count; i++) {
+        if (process_config[i].deps_down == 0) {
+            signal_stop(i); // Nothing depends on it any more
+        }
+    }
+
+    for (int i = 0; i < loaded; i++) {
+        if (!adopted[i]) {
+            cgroup_setup(i);
+        } else if (changed[i]) {
+            log_event(LOG_INFO, EV_SERVICE_CHANGED, i, processes[i].pid, 0, 0, changed[i]);
+            if (strcmp(changed[i], "resource limits") == 0) {
+                cgroup_release(&process_config[i]);
+                cgroup_setup(i); // Same cgroup, new limits; the service keeps running
+            } else if (processes[i].pid > 0 && processes[i].state == STATE_RUNNING) {
+                restart_service(i);
             }
         }
     }
 
-    fclose(config);
+    // Fork every startable service at once; everything else is started from
+    // mark_running() as soon as its last prerequisite is up.
+    for (int k = 0; k < boot_count; k++) {
+        int i = boot_order[k];
+        if (processes[i].state == STATE_WAITING && process_config[i].deps_down == 0 && processes[i].pid == 0) {
+            start_process(i);
+        }
+    }
+
+    free(old);
+    free(old_cfg);
+    free(retired);
+    free(stop_edges);
+    free(changed);
+    free(adopted);
+}
+
+void restart_service(int i) {
+    process_config[i].restarts_total++;
+    if (processes[i].pid > 0) {
+        // Started again by reap_children() once the old instance is gone
+        set_state(i, STATE_RESTARTING);
+        signal_stop(i);
+    } else {
+        start_process(i);
+    }
 }
 
 void switch_runlevel(int new_runlevel) {
+    if (shutting_down) return;
     if (new_runlevel < 0 || new_runlevel >= MAX_RUNLEVELS) {
-        log_message("Invalid runlevel");
+        log_message(LOG_ERROR, "Invalid runlevel");
         return;
     }
 
-    char log_msg[512];
-    snprintf(log_msg, sizeof(log_msg), "Switching from runlevel %d to %d", current_runlevel, new_runlevel);
-    log_message(log_msg);
+    log_event(LOG_INFO, EV_RUNLEVEL_SWITCH, -1, 0, current_runlevel, new_runlevel, NULL);
 
+    // Services in both runlevels carry over untouched; see init_processes()
     current_runlevel = new_runlevel;
+    init_processes();
+}
 
-    // Restart processes according to the new runlevel
-    for (int i = 0; i < process_count; i++) {
-        if (processes[i].active) {
-            kill(processes[i].pid, SIGTERM); // Terminate existing processes
+// CPU time a service has used in us, low 32 bits, from its cgroup or its main process
+bool service_cpu_usage(int i, uint32_t *usage) {
+    char buf[512];
+    ssize_t n = -1;
+#if INIT_CGROUPS
+    if (process_config[i].cpu_stat_fd >= 0) {
+        n = pread(process_config[i].cpu_stat_fd, buf, sizeof(buf) - 1, 0);
+        if (n > 0) {
+            buf[n] = '\0';
+            *usage = cgroup_counter(buf, "usage_usec");
+        }
+        return n > 0;
+    }
+#endif
+    snprintf(buf, sizeof(buf), "/proc/%d/schedstat", processes[i].pid);
+    int fd = open(buf, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        n = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+    }
+    if (n <= 0) return false;
+    buf[n] = '\0';
+    *usage = strtoull(buf, NULL, 10) / 1000; // Nanoseconds on the CPU
+    return true;
+}
+
+// An idle= service is busy while it keeps using CPU, which also covers
+// clients on connections it already has, or while new connections are seen
+// arriving. A service that accepts at once often wins that race, so CPU time
+// is what counts. One that has been idle for its idle time is stopped and
+// goes back to listening; the next connection starts it again, and clients
+// only see the startup delay. The first check after a start only takes a
+// baseline: what the startup itself used is the start, which already counts.
+void idle_check(int i, uint64_t now) {
+    ProcessConfig *cfg = &process_config[i];
+    uint32_t usage;
+    if (service_cpu_usage(i, &usage)) {
+        if (cfg->cpu_sampled && usage - cfg->cpu_usage >= IDLE_CPU_US) { // Wraps harmlessly
+            cfg->active_at = now;
         }
+        cfg->cpu_usage = usage;
+        cfg->cpu_sampled = true;
     }
-    process_count = 0; // Clear current processes
-    init_processes(); // Start new processes for the new runlevel
+    if (now - cfg->active_at < cfg->idle_ms) return;
+    log_event(LOG_INFO, EV_IDLE_STOP, i, processes[i].pid, (now - cfg->active_at) / 1000, 0, NULL);
+    cfg->idle_stopping = true;
+    set_state(i, STATE_STOPPING);
+    signal_stop(i);
 }
 
+// Periodic sweep driven by the event loop's timerfd. Crashes are restarted by
+// their backoff timer; this only retries services whose timed restart did not
+// get them running, e.g. because a dependency was down or fork() failed.
 void health_check() {
+    uint64_t now = monotonic_ms();
+    for (int i = 0; i < process_count; i++) {
+        if (processes[i].state == STATE_CRASHED && process_config[i].restart_at == 0 && processes[i].pid == 0) {
+            restart_crashed(i);
+        } else if (processes[i].state == STATE_RUNNING && process_config[i].idle_ms && i < named_count) {
+            idle_check(i, now);
+        }
+    }
+}
+
+void reload_configuration() {
+    if (shutting_down) return;
+    log_message(LOG_INFO, "Reloading configuration...");
+    init_processes(); // Diffed against the running table
+}
+
+// Shutdown is a transition to an empty runlevel: every service is retired and
+// stopped in parallel in reverse dependency order, exits are collected by the
+// event loop and anything overrunning its deadline is killed, so shutdown
+// takes as long as the slowest dependency chain, bounded by stop_timeout per
+// link. shutdown_complete() exits once the last service is reaped.
+void graceful_shutdown() {
+    if (shutting_down) return;
+    log_message(LOG_INFO, "Shutting down init system...");
+    shutting_down = true;
+    shutdown_started = monotonic_ms();
+    init_processes();
+    shutdown_complete();
+}
+
+void shutdown_complete() {
+    for (int i = 0; i < process_count; i++) {
+        if (processes[i].pid > 0) return;
+    }
+    for (int i = named_count; i < process_count; i++) { // All of them, once shutdown has retired them
+        log_event(LOG_INFO, EV_STOP_SUMMARY, i, 0, process_config[i].stop_ms, process_config[i].stop_killed, NULL);
+    }
+    log_event(LOG_INFO, EV_SHUTDOWN_COMPLETE, -1, 0, monotonic_ms() - shutdown_started, 0, NULL);
+    log_flush();
+    cgroup_remove();
+    exit(0);
+}
+
+#if INIT_REEXEC
+// Re-exec. The whole table is written to a memfd and handed to the new
+// binary, which restores it as the "previous" table and then loads the
+// inittab through init_processes() as any reload would: every running
+// service is adopted, keeping its PID, notify socket and listen sockets,
+// which stay open across the exec. The snapshot is an explicit format rather
+// than the in-memory structs, and record_size keeps an incompatible build
+// from misreading it. Exits in the gap stay zombies with SIGCHLD pending, so
+// nothing is missed.
+#define STATE_MAGIC "INITSTA1"
+#define STATE_FD_ENV "INIT_STATE_FD"
+
+typedef struct {
+    char magic[8];        // STATE_MAGIC
+    uint32_t record_size; // sizeof(StateRecord)
+    uint32_t size;        // Total bytes
+    uint64_t written_us;  // CLOCK_MONOTONIC
+    uint32_t count;       // Records following the header
+    uint32_t named_count;
+    uint32_t runlevel;
+    uint32_t deps;        // Offset of the int32_t dep_ids section
+    uint32_t dep_count;
+    uint32_t strings;     // Offset of a copy of the string arena, which runs to the end
+} StateHeader;
+
+typedef struct {
+    uint32_t command; // String offsets, as in ProcessConfig
+    uint32_t path;
+    uint32_t dependencies;
+    uint32_t listen;
+    int32_t pid;
+    uint8_t state;
+    uint8_t runlevel;
+    uint16_t restart_count;
+    uint16_t instance;
+    uint16_t instances;
+    uint8_t pin;
+    uint8_t sched_policy;
+    uint8_t sched_priority;
+    int8_t nice;
+    uint16_t ioprio;
+    int16_t oom_score_adj;
+    uint8_t notify;
+    uint8_t stop_killed;
+    uint8_t idle_stopping;
+    uint8_t start_when_empty;
+    uint8_t listen_count;
+    int32_t notify_fd;
+    int32_t listen_fds[LISTEN_MAX];
+    int32_t memory_limit;
+    int32_t cpu_limit;
+    uint32_t watchdog_ms;
+    uint32_t idle_ms;
+    uint32_t stop_ms;
+    uint32_t restarts_total;
+    uint32_t cpu_usage;
+    uint32_t dep_start; // Entries of the dep_ids section
+    uint32_t dep_count;
+    uint64_t start_time;
+    int64_t crash_window_start;
+    uint64_t restart_at;
+    uint64_t stop_started;
+    uint64_t kill_at;
+    uint64_t alive_at;
+    uint64_t active_at;
+} StateRecord;
+
+char **init_argv;
+bool reexec_pending = false; // Set by a control request, carried out by the event loop
+
+// Write the table into a memfd, or return -1.
+int state_write() {
+    uint32_t deps = sizeof(StateHeader) + process_count * sizeof(StateRecord);
+    uint32_t strings = deps + dep_ids_count * sizeof(int32_t);
+    uint32_t size = strings + (arena_len ? arena_len : 1);
+    char *buf = xrealloc(NULL, size);
+    StateHeader header = {STATE_MAGIC, sizeof(StateRecord), size,    monotonic_us(), process_count, named_count,
+                          current_runlevel, deps,              dep_ids_count, strings};
+    memcpy(buf, &header, sizeof(header));
+    StateRecord *records = (StateRecord *)(buf + sizeof(header));
+    for (int i = 0; i < process_count; i++) {
+        const Process *p = &processes[i];
+        const ProcessConfig *cfg = &process_config[i];
+        StateRecord *rec = &records[i];
+        *rec = (StateRecord){
+            .command = cfg->command,
+            .path = cfg->path,
+            .dependencies = cfg->dependencies,
+            .listen = cfg->listen,
+            .pid = p->pid,
+            .state = p->state,
+            .runlevel = p->runlevel,
+            .restart_count = p->restart_count,
+            .instance = cfg->instance,
+            .instances = cfg->instances,
+            .pin = cfg->pin,
+            .sched_policy = cfg->sched_policy,
+            .sched_priority = cfg->sched_priority,
+            .nice = cfg->nice,
+            .ioprio = cfg->ioprio,
+            .oom_score_adj = cfg->oom_score_adj,
+            .notify = cfg->notify,
+            .stop_killed = cfg->stop_killed,
+            .idle_stopping = cfg->idle_stopping,
+            .start_when_empty = cfg->start_when_empty,
+            .listen_count = cfg->listen_count,
+            .notify_fd = cfg->notify_fd,
+            .memory_limit = cfg->memory_limit,
+            .cpu_limit = cfg->cpu_limit,
+            .watchdog_ms = cfg->watchdog_ms,
+            .idle_ms = cfg->idle_ms,
+            .stop_ms = cfg->stop_ms,
+            .restarts_total = cfg->restarts_total,
+            .cpu_usage = cfg->cpu_usage,
+            .dep_start = cfg->dep_start,
+            .dep_count = cfg->dep_count,
+            .start_time = cfg->start_time,
+            .crash_window_start = cfg->crash_window_start,
+            .restart_at = cfg->restart_at,
+            .stop_started = cfg->stop_started,
+            .kill_at = cfg->kill_at,
+            .alive_at = cfg->alive_at,
+            .active_at = cfg->active_at,
+        };
+        memcpy(rec->listen_fds, cfg->listen_fds, sizeof(rec->listen_fds));
+    }
+    if (dep_ids_count) memcpy(buf + deps, dep_ids, dep_ids_count * sizeof(int32_t));
+    buf[strings] = '\0';
+    if (arena_len) memcpy(buf + strings, string_arena, arena_len);
+
+    int fd = memfd_create("init-state", MFD_CLOEXEC);
+    if (fd >= 0 && write(fd, buf, size) != (ssize_t)size) {
+        close(fd);
+        fd = -1;
+    }
+    free(buf);
+    return fd;
+}
+
+// Let the fds a restored table refers to survive the exec, or close on exec
+// again once it has failed or the table is restored.
+void state_inherit(int state_fd, bool inherit) {
+    int fds[LISTEN_MAX + 1];
+    if (state_fd >= 0) fcntl(state_fd, F_SETFD, inherit ? 0 : FD_CLOEXEC);
+    for (int i = 0; i < process_count; i++) {
+        const ProcessConfig *cfg = &process_config[i];
+        int n = 0;
+        if (cfg->notify_fd >= 0) fds[n++] = cfg->notify_fd;
+        for (int k = 0; k < cfg->listen_count; k++) fds[n++] = cfg->listen_fds[k];
+        for (int k = 0; k < n; k++) {
+            fcntl(fds[k], F_SETFD, inherit ? 0 : FD_CLOEXEC);
+        }
+    }
+}
+
+// Replace ourselves with the init binary on disk, which may be a new version,
+// without disturbing any service. Only returns if the exec failed.
+void supervisor_reexec() {
+    reexec_pending = false;
+    // argv[0] names the file, so an upgraded binary installed over it is
+    // what runs; /proc/self/exe would be the old, unlinked one
+    const char *binary = init_argv[0] && strchr(init_argv[0], '/') ? init_argv[0] : "/proc/self/exe";
+    int state_fd = state_write();
+    if (state_fd < 0) {
+        log_event(LOG_ERROR, EV_REEXEC_FAILED, -1, 0, errno, 0, binary);
+        return;
+    }
+    char value[16];
+    snprintf(value, sizeof(value), "%d", state_fd);
+    setenv(STATE_FD_ENV, value, 1);
+    state_inherit(state_fd, true);
+    log_event(LOG_INFO, EV_REEXEC, -1, 0, process_count, 0, binary);
+    log_flush();
+
+    execv(binary, init_argv);
+
+    log_event(LOG_ERROR, EV_REEXEC_FAILED, -1, 0, errno, 0, binary);
+    state_inherit(state_fd, false);
+    unsetenv(STATE_FD_ENV);
+    close(state_fd);
+}
+
+bool state_valid(const char *image, size_t size) {
+    const StateHeader *h = (const StateHeader *)image;
+    if (size < sizeof(*h) || memcmp(h->magic, STATE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->record_size != sizeof(StateRecord) || h->size != size || image[size - 1] != '\0' ||
+        h->count > (size - sizeof(*h)) / sizeof(StateRecord) || h->named_count > h->count ||
+        h->runlevel >= MAX_RUNLEVELS || h->deps != sizeof(*h) + h->count * sizeof(StateRecord) ||
+        h->dep_count > (size - h->deps) / sizeof(int32_t) || h->strings != h->deps + h->dep_count * sizeof(int32_t)) {
+        return false;
+    }
+    uint32_t strings_len = size - h->strings;
+    const StateRecord *records = (const StateRecord *)(image + sizeof(*h));
+    const int32_t *deps = (const int32_t *)(image + h->deps);
+    for (uint32_t k = 0; k < h->count; k++) {
+        const StateRecord *rec = &records[k];
+        if (rec->command >= strings_len || rec->path >= strings_len || rec->dependencies >= strings_len ||
+            rec->listen >= strings_len || rec->state >= STATE_COUNT || rec->listen_count > LISTEN_MAX ||
+            rec->dep_start > h->dep_count || rec->dep_count > h->dep_count - rec->dep_start) {
+            return false;
+        }
+    }
+    for (uint32_t d = 0; d < h->dep_count; d++) {
+        if (deps[d] < 0 || (uint32_t)deps[d] >= h->count) return false;
+    }
+    return true;
+}
+
+// Signal every process whose parent we are; returns how many there were
+int signal_children(int sig) {
+    DIR *dir = opendir("/proc");
+    struct dirent *entry;
+    int count = 0;
+    while (dir && (entry = readdir(dir))) {
+        char path[64], buf[512];
+        pid_t pid = atoi(entry->d_name);
+        if (pid <= 0) continue;
+        snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        ssize_t n = fd >= 0 ? read(fd, buf, sizeof(buf) - 1) : -1;
+        if (fd >= 0) close(fd);
+        if (n <= 0) continue;
+        buf[n] = '\0';
+        const char *fields = strrchr(buf, ')'); // The command in between may hold anything
+        int ppid = 0;
+        if (fields && sscanf(fields, ") %*c %d", &ppid) == 1 && ppid == getpid()) {
+            kill(pid, sig);
+            count++;
+        }
+    }
+    if (dir) closedir(dir);
+    return count;
+}
+
+// The previous supervisor's state cannot be used, e.g. because an
+// incompatible build wrote it. Its services are still our children and
+// still hold the sockets it handed over, so rather than start a second copy
+// of each, close those and stop every child, as a shutdown would, before
+// everything is started afresh.
+void state_discard() {
+    // Everything we open is close-on-exec; whatever is not came from it
+    DIR *dir = opendir("/proc/self/fd");
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir))) {
+        int fd = atoi(entry->d_name);
+        if (fd > 2 && !(fcntl(fd, F_GETFD) & FD_CLOEXEC)) close(fd);
+    }
+    if (dir) closedir(dir);
+
+    log_event(LOG_ERROR, EV_STATE_REJECTED, -1, 0, signal_children(SIGTERM), 0, NULL);
+    log_flush();
+    uint64_t kill_at = monotonic_ms() + stop_timeout;
+    for (pid_t pid; (pid = waitpid(-1, NULL, WNOHANG)) >= 0;) {
+        if (pid > 0) continue;
+        if (monotonic_ms() >= kill_at) {
+            signal_children(SIGKILL);
+            kill_at = UINT64_MAX;
+        }
+        usleep(10000);
+    }
+}
+
+// Rebuild the table a previous supervisor handed over in INIT_STATE_FD, so
+// that init_processes() adopts its services. Without one the table stays
+// empty and everything is started as at boot.
+void state_restore() {
+    const char *value = getenv(STATE_FD_ENV);
+    if (!value) return;
+    char *end;
+    long fd = strtol(value, &end, 10);
+    bool valid_fd = end != value && !*end && fd >= 3 && fd <= INT_MAX; // Never stdin, stdout or stderr
+    unsetenv(STATE_FD_ENV); // Not for the services
+    struct stat st;
+    char *image = valid_fd && fstat(fd, &st) == 0 && st.st_size > 0
+                      ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)
+                      : MAP_FAILED;
+    if (valid_fd) close(fd);
+    if (image == MAP_FAILED || !state_valid(image, st.st_size)) {
+        if (image != MAP_FAILED) munmap(image, st.st_size);
+        state_discard();
+        return;
+    }
+
+    const StateHeader *h = (const StateHeader *)image;
+    const StateRecord *records = (const StateRecord *)(image + sizeof(*h));
+    const char *strings = image + h->strings;
+    for (uint32_t k = 0; k < h->count; k++) {
+        const StateRecord *rec = &records[k];
+        int i = add_service();
+        processes[i] = (Process){rec->pid, rec->state, rec->runlevel, rec->restart_count};
+        process_config[i] = (ProcessConfig){
+            .command = intern_string(strings + rec->command),
+            .path = intern_string(strings + rec->path),
+            .instance = rec->instance,
+            .instances = rec->instances,
+            .pin = rec->pin,
+            .sched_policy = rec->sched_policy,
+            .sched_priority = rec->sched_priority,
+            .nice = rec->nice,
+            .ioprio = rec->ioprio,
+            .oom_score_adj = rec->oom_score_adj,
+            .dependencies = intern_string(strings + rec->dependencies),
+            .dep_start = rec->dep_start,
+            .dep_count = rec->dep_count,
+            .notify_fd = rec->notify_fd,
+            .memory_limit = rec->memory_limit,
+            .cpu_limit = rec->cpu_limit,
+            .notify = rec->notify,
+            .watchdog_ms = rec->watchdog_ms,
+            .start_time = rec->start_time,
+            .crash_window_start = rec->crash_window_start,
+            .restart_at = rec->restart_at,
+            .stop_started = rec->stop_started,
+            .kill_at = rec->kill_at,
+            .stop_ms = rec->stop_ms,
+            .stop_killed = rec->stop_killed,
+            .restarts_total = rec->restarts_total,
+            .alive_at = rec->alive_at,
+            .listen = intern_string(strings + rec->listen),
+            .listen_count = rec->listen_count,
+            .idle_ms = rec->idle_ms,
+            .active_at = rec->active_at,
+            .cpu_usage = rec->cpu_usage,
+            .idle_stopping = rec->idle_stopping,
+            .start_when_empty = rec->start_when_empty,
+            .cgroup_fd = -1,
+            .cgroup_procs_fd = -1,
+            .memory_events_fd = -1,
+            .cgroup_events_fd = -1,
+            .memory_pressure_fd = -1,
+            .cpu_stat_fd = -1,
+        };
+        memcpy(process_config[i].listen_fds, rec->listen_fds, sizeof(rec->listen_fds));
+    }
+    named_count = h->named_count;
+    current_runlevel = h->runlevel;
+    dep_ids_capacity = h->dep_count ? h->dep_count : 64;
+    dep_ids = xrealloc(dep_ids, dep_ids_capacity * sizeof(int));
+    memcpy(dep_ids, image + h->deps, h->dep_count * sizeof(int));
+    dep_ids_count = h->dep_count;
+
+    state_inherit(-1, false); // Not for the services we start from now on
+
+    // Registered as init_processes() expects of a live table: it only
+    // modifies what is already being watched
+    for (int i = 0; i < process_count; i++) {
+        ProcessConfig *cfg = &process_config[i];
+        cgroup_setup(i);
+        if (cfg->notify_fd >= 0) {
+            watch_fd(cfg->notify_fd, EPOLLIN, EVENT_NOTIFY, i);
+        }
+        listen_watch(i, listen_events(i));
+    }
+    log_event(LOG_INFO, EV_STATE_RESTORED, -1, 0, process_count, (monotonic_us() - h->written_us) / 1000, NULL);
+    munmap(image, st.st_size);
+}
+#endif
+
+#if INIT_CONTROL
+// Carry out one control request against the live table.
+CtlStatus control_request(const CtlRequest *req, const char *name, CtlResponse *resp) {
+    if (req->op >= CTL_OP_COUNT) return CTL_ERR_BAD_REQUEST;
+    if (req->op != CTL_STATUS && shutting_down) return CTL_ERR_SHUTTING_DOWN;
+    if (req->op == CTL_SWITCH) {
+        if (req->arg >= MAX_RUNLEVELS) return CTL_ERR_BAD_RUNLEVEL;
+        switch_runlevel(req->arg);
+        return CTL_OK;
+    }
+    if (req->op == CTL_REEXEC) {
+#if INIT_REEXEC
+        reexec_pending = true; // Once the answer is sent
+        return CTL_OK;
+#else
+        return CTL_ERR_UNSUPPORTED;
+#endif
+    }
+
+    int i = find_service(name);
+    if (i < 0) return CTL_ERR_UNKNOWN_SERVICE;
+    if (req->op == CTL_START) {
+        // Also how a crash-looped service is retried
+        if (processes[i].pid == 0) {
+            processes[i].restart_count = 0;
+            process_config[i].restart_at = 0;
+            start_process(i);
+        }
+    } else if (req->op == CTL_STOP) {
+        uint8_t state = processes[i].state;
+        if (state == STATE_RUNNING || state == STATE_STARTING || state == STATE_RESTARTING) {
+            set_state(i, STATE_STOPPING); // STATE_STOPPED once reaped, and not started again
+            signal_stop(i);
+        } else if (state == STATE_LISTENING) {
+            listen_watch(i, 0); // Not activated again until started
+            set_state(i, STATE_STOPPED);
+        } else if (state == STATE_CRASHED || state == STATE_WAITING) {
+            // Cancels a pending restart: its timer entry no longer matches
+            // restart_at and is skipped when it comes up
+            process_config[i].restart_at = 0;
+            set_state(i, STATE_STOPPED);
+        }
+        process_config[i].idle_stopping = false;
+    } else if (req->op == CTL_RESTART) {
+        restart_service(i);
+    }
+    resp->state = processes[i].state;
+    resp->pid = processes[i].pid;
+    resp->restart_count = processes[i].restart_count;
+    return CTL_OK;
+}
+
+// Hand data to a client as a memfd it can read or map but never change.
+int sealed_memfd(const char *name, const char *data, size_t size) {
+    int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) return -1;
+    if (write(fd, data, size) != (ssize_t)size ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+        close(fd);
+        return -1;
+    }
+    lseek(fd, 0, SEEK_SET); // The offset is shared with the client's copy
+    return fd;
+}
+
+// Write the whole table into a sealed memfd, or return -1. Sealing makes the
+// snapshot immutable, so a reader can map it without trusting us not to
+// change it underneath.
+int control_snapshot() {
+    static char *buf;
+    static size_t capacity;
+    uint32_t strings = sizeof(CtlSnapshotHeader) + process_count * sizeof(CtlServiceRecord);
+    size_t size = strings;
+    for (int i = 0; i < process_count; i++) {
+        size += strlen(service_command(i)) + 1;
+    }
+    if (size > capacity) {
+        capacity = size * 2;
+        buf = xrealloc(buf, capacity);
+    }
+
+    CtlSnapshotHeader header = {CTL_SNAPSHOT_MAGIC, realtime_ns(), process_count, current_runlevel, strings, size};
+    memcpy(buf, &header, sizeof(header));
+    CtlServiceRecord *records = (CtlServiceRecord *)(buf + sizeof(header));
+    uint64_t now = monotonic_us();
+    uint32_t name = 0;
+    for (int i = 0; i < process_count; i++) {
+        const Process *p = &processes[i];
+        const ProcessConfig *cfg = &process_config[i];
+        const char *command = service_command(i);
+        uint32_t len = strlen(command) + 1;
+        records[i] = (CtlServiceRecord){name, p->pid, p->pid > 0 ? (now - cfg->start_time) / 1000 : 0, p->state,
+                                        p->runlevel, p->restart_count, cfg->memory_limit, cfg->cpu_limit, 0};
+        memcpy(buf + strings + name, command, len);
+        name += len;
+    }
+
+    return sealed_memfd("init-snapshot", buf, size);
+}
+
+#if INIT_TRACE
+// The trace with the arena as its name section, in a sealed memfd.
+int control_trace() {
+    uint32_t strings = sizeof(CtlTraceHeader) + trace_count * sizeof(CtlTraceEvent);
+    uint32_t size = strings + (arena_len ? arena_len : 1);
+    char *buf = xrealloc(NULL, size);
+    CtlTraceHeader header = {CTL_TRACE_MAGIC, trace_start_us, trace_count, trace_dropped, strings, size};
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + sizeof(header), trace_events, trace_count * sizeof(CtlTraceEvent));
+    buf[strings] = '\0';
+    if (arena_len) memcpy(buf + strings, string_arena, arena_len);
+    int fd = sealed_memfd("init-trace", buf, size);
+    free(buf);
+    return fd;
+}
+#else
+int control_trace() {
+    return -1;
+}
+#endif
+
+#if INIT_METRICS
+void metrics_histogram(FILE *out, const char *name, const char *help, const Histogram *h) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    uint64_t cumulative = 0;
+    for (int k = 0; k < HISTOGRAM_BUCKETS - 1; k++) {
+        cumulative += h->buckets[k];
+        fprintf(out, "%s_bucket{le=\"%.6f\"} %llu\n", name, (double)(1u << k) / 1e6, (unsigned long long)cumulative);
+    }
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)h->count);
+    fprintf(out, "%s_sum %.6f\n%s_count %llu\n", name, h->sum_us / 1e6, name, (unsigned long long)h->count);
+}
+
+// Prometheus text exposition of the histograms and per-service counters.
+int control_metrics() {
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+    if (!out) return -1;
+    metrics_histogram(out, "init_spawn_seconds", "Time from clone() until the child has exec'd.", &spawn_latency);
+    metrics_histogram(out, "init_ready_seconds", "Time from clone() until a service counts as running.",
+                      &ready_latency);
+    metrics_histogram(out, "init_reap_lag_seconds", "Time from the wakeup reporting SIGCHLD until the child is reaped.",
+                      &reap_lag);
+    metrics_histogram(out, "init_log_flush_seconds", "Time spent writing out the log ring.", &flush_latency);
+
+    fprintf(out, "# HELP init_service_restarts_total Restarts of each service since it was loaded.\n"
+                 "# TYPE init_service_restarts_total counter\n");
+    for (int i = 0; i < named_count; i++) {
+        fprintf(out, "init_service_restarts_total{service=\"");
+        for (const char *c = service_command(i); *c; c++) {
+            if (*c == '"' || *c == '\\') fputc('\\', out);
+            fputc(*c, out);
+        }
+        fprintf(out, "\"} %u\n", process_config[i].restarts_total);
+    }
+    fclose(out);
+    int fd = sealed_memfd("init-metrics", text, size);
+    free(text);
+    return fd;
+}
+#else
+int control_metrics() {
+    return -1;
+}
+#endif
+
+// Send a response, with an fd attached if attach is not -1.
+bool control_send(int fd, const CtlResponse *resp, int attach) {
+    struct iovec iov = {(void *)resp, sizeof(*resp)};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    if (attach >= 0) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &attach, sizeof(int));
+    }
+    return sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof(*resp);
+}
+
+// Serve one connected client: answer up to CTL_BATCH pipelined requests, then
+// give the rest of the loop a turn. A client that hangs up, sends garbage or
+// stops reading its answers is dropped.
+void control_client_read(int fd) {
+    for (int n = 0; n < CTL_BATCH; n++) {
+        char buf[sizeof(CtlRequest) + CTL_NAME_MAX + 1];
+        ssize_t len = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+        if (len < 0 && (errno == EAGAIN || errno == EINTR)) return;
+        if (len <= 0) break; // Hung up
+
+        CtlRequest req;
+        CtlResponse resp = {0};
+        int snapshot = -1;
+        memcpy(&req, buf, len < (ssize_t)sizeof(req) ? (size_t)len : sizeof(req));
+        resp.tag = req.tag;
+        if (len < (ssize_t)sizeof(req) || len != (ssize_t)sizeof(req) + req.name_len) {
+            resp.status = CTL_ERR_BAD_REQUEST;
+        } else if ((req.op == CTL_METRICS && !INIT_METRICS) || (req.op == CTL_TRACE && !INIT_TRACE)) {
+            resp.status = CTL_ERR_UNSUPPORTED;
+        } else if (req.op == CTL_SNAPSHOT || req.op == CTL_METRICS || req.op == CTL_TRACE) {
+            snapshot = req.op == CTL_SNAPSHOT  ? control_snapshot()
+                       : req.op == CTL_METRICS ? control_metrics()
+                                               : control_trace();
+            resp.status = snapshot >= 0 ? CTL_OK : CTL_ERR_SNAPSHOT_FAILED;
+        } else {
+            buf[len] = '\0';
+            resp.status = control_request(&req, buf + sizeof(req), &resp);
+        }
+        resp.runlevel = current_runlevel;
+        bool sent = control_send(fd, &resp, snapshot);
+        if (snapshot >= 0) close(snapshot); // The client holds its own reference now
+        if (!sent) break;
+        if (n == CTL_BATCH - 1) return; // More may be queued; epoll will tell us
+    }
+    close(fd); // Closing also drops it from epoll
+}
+
+void control_accept() {
+    for (int n = 0; n < CTL_BATCH; n++) {
+        int fd = accept4(control_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+        watch_fd(fd, EPOLLIN, EVENT_CONTROL_CLIENT, fd);
+    }
+}
+
+// Open the control socket initctl talks to. Only root may connect.
+void control_init() {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, ctl_socket_path, sizeof(addr.sun_path) - 1);
+    control_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (control_fd < 0) {
+        log_message(LOG_WARNING, "Cannot create control socket");
+        return;
+    }
+    unlink(ctl_socket_path);
+    mode_t mask = umask(0077);
+    int bound = bind(control_fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (bound < 0 || listen(control_fd, SOMAXCONN) < 0) {
+        char message[PATH_MAX + 32];
+        snprintf(message, sizeof(message), "Cannot listen on %s", ctl_socket_path);
+        log_message(LOG_WARNING, message);
+        close(control_fd);
+        control_fd = -1;
+        return;
+    }
+    watch_fd(control_fd, EPOLLIN, EVENT_CONTROL, 0);
+}
+#else
+void control_init() {
+}
+#endif
+
+void handle_signal(const struct signalfd_siginfo *info) {
+    switch (info->ssi_signo) {
+    case SIGCHLD:
+        reap_children();
+        break;
+    case SIGTERM:
+        graceful_shutdown();
+        break;
+    case SIGHUP:
+        reload_configuration();
+        break;
+    }
+}
+
+// Single supervisor loop: child exits, shutdown/reload requests and periodic
+// health sweeps all arrive as fd events, so PID 1 sleeps in epoll_wait() when
+// there is nothing to do.
+void event_loop() {
+    struct epoll_event events[16];
     while (1) {
-        sleep(HEALTH_CHECK_INTERVAL);
-        for (int i = 0; i < process_count; i++) {
-            if (!processes[i].active) {
-                // Process has finished, restart it
-                char log_msg[512];
-                snprintf(log_msg, sizeof(log_msg), "Restarting process: %s", processes[i].command);
-                log_message(log_msg);
-                start_process(processes[i].command, processes[i].runlevel);
+        log_flush();
+        int n = epoll_wait(epoll_fd, events, 16, -1);
+        wakeup_us = monotonic_us();
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            continue;
+        }
+        for (int k = 0; k < n; k++) {
+            EventSource source = events[k].data.u64 >> 32;
+            int i = (int)(uint32_t)events[k].data.u64;
+            if (source == EVENT_SIGNAL) {
+                struct signalfd_siginfo info;
+                while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                    handle_signal(&info);
+                }
+            } else if (source == EVENT_TIMER) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                    health_check();
+                }
+            } else if (source == EVENT_SERVICE_TIMER) {
+                uint64_t expirations;
+                if (read(service_timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                    service_timers_expired();
+                }
+#if INIT_CONTROL
+            } else if (source == EVENT_CONTROL) {
+                control_accept();
+            } else if (source == EVENT_CONTROL_CLIENT) {
+                control_client_read(i);
+#endif
+            } else if (i >= process_count) {
+                continue; // Event for a table that has since been reloaded
+            } else if (source == EVENT_MEMORY_EVENTS) {
+                memory_events_read(i, true);
+            } else if (source == EVENT_CGROUP_EVENTS) {
+                cgroup_events_read(i);
+            } else if (source == EVENT_MEMORY_PRESSURE) {
+                memory_pressure_event(i);
+            } else if (source == EVENT_NOTIFY && process_config[i].notify_fd >= 0) {
+                notify_read(i);
+#if INIT_SOCKET_ACTIVATION
+            } else if (source == EVENT_LISTEN && processes[i].state == STATE_LISTENING) {
+                socket_activate(i);
+            } else if (source == EVENT_LISTEN) {
+                process_config[i].active_at = monotonic_ms();
+#endif
             }
         }
+#if INIT_REEXEC
+        if (reexec_pending) {
+            supervisor_reexec();
+        }
+#endif
     }
 }
 
-int main(int argc, char *argv[]) {
-    // Set up signal handler for SIGCHLD
-    signal(SIGCHLD, handle_signal);
+// A positive integer setting from the environment, at most max. Anything
+// else, e.g. 0, which would make every crash a crash loop, falls back to the
+// default; a larger number is clamped.
+int env_positive(const char *name, int fallback, int max) {
+    const char *value = getenv(name);
+    if (!value) return fallback;
+    char *end;
+    long n = strtol(value, &end, 10); // LONG_MAX on overflow, which is clamped too
+    char message[128];
+    if (end == value || *end || n <= 0) {
+        snprintf(message, sizeof(message), "Ignoring %s=%.32s: not a positive integer, using %d", name, value, fallback);
+        log_message(LOG_WARNING, message);
+        return fallback;
+    }
+    if (n > max) {
+        snprintf(message, sizeof(message), "Clamping %s=%.32s to %d", name, value, max);
+        log_message(LOG_WARNING, message);
+        return max;
+    }
+    return n;
+}
 
-    // Initialization message
-    log_message("Starting init...");
+int main(int argc, char *argv[]) {
+    (void)argc;
+#if INIT_REEXEC
+    init_argv = argv;
+#else
+    (void)argv;
+#endif
+    paths_init();
+#if INIT_BINARY_LOG
+    const char *log_format = getenv("INIT_LOG_FORMAT");
+    log_binary = log_format && strcmp(log_format, "binary") == 0;
+#endif
+    // restart_count is 16 bits; a higher limit would let it wrap and never trip
+    restart_limit = env_positive("INIT_RESTART_LIMIT", RESTART_LIMIT, UINT16_MAX);
+    restart_delay_max = env_positive("INIT_RESTART_DELAY_MAX", RESTART_DELAY_MAX_MS, INT_MAX);
+    stop_timeout = env_positive("INIT_STOP_TIMEOUT", STOP_TIMEOUT_MS, INT_MAX);
+    trace_start_us = monotonic_us();
+    srandom(getpid() ^ monotonic_ms());
+    if (getpid() != 1) {
+        // Run as a test or benchmark supervisor: orphans of our services come
+        // to us, as they would to PID 1, instead of to the real init
+        prctl(PR_SET_CHILD_SUBREAPER, 1);
+    }
 
-    // Start services from configuration
-    init_processes();
+    // Signals are taken synchronously through a signalfd; block them before
+    // the first fork so no exit can be missed.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0) {
+        perror("signalfd");
+        exit(EXIT_FAILURE);
+    }
 
-    // Start health check thread
-    if (fork() == 0) {
-        health_check(); // Child process for health checking
-        exit(0);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        perror("timerfd_create");
+        exit(EXIT_FAILURE);
+    }
+    struct itimerspec interval = {{HEALTH_CHECK_INTERVAL, 0}, {HEALTH_CHECK_INTERVAL, 0}};
+    timerfd_settime(timer_fd, 0, &interval, NULL);
+    service_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (service_timer_fd < 0) {
+        perror("timerfd_create");
+        exit(EXIT_FAILURE);
     }
 
-    // Main loop
-    while (1) {
-        sleep(10); // Main loop doing nothing, waiting for signals
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
     }
+    watch_fd(signal_fd, EPOLLIN, EVENT_SIGNAL, 0);
+    watch_fd(timer_fd, EPOLLIN, EVENT_TIMER, 0);
+    watch_fd(service_timer_fd, EPOLLIN, EVENT_SERVICE_TIMER, 0);
+
+    log_message(LOG_INFO, "Starting init...");
+
+    cgroup_init();
+    topology_init();
+#if INIT_REEXEC
+    state_restore(); // After a re-exec: the table to adopt services from
+#endif
+    init_processes();
+    control_init(); // Runtime start/stop/restart/status/switch, see initctl
+
+    event_loop();
 
     return 0;
 }
@@ -0,0 +1,455 @@
+// Client for the control socket of init_main.c.
+//
+//   cc -O2 -o initctl initctl.c
+//   initctl {status|start|stop|restart} <service>...
+//   initctl switch <runlevel>
+//   initctl snapshot
+//   initctl metrics
+//   initctl trace > boot.json
+//   initctl critical-path [service]
+//
+// Requests for several services go out back to back on one connection and
+// the answers are read afterwards, so a status sweep costs one round trip.
+// snapshot prints every service from a single memfd snapshot of the table;
+// metrics prints the supervisor's Prometheus text, e.g. for a textfile
+// collector. trace prints the boot timeline as Chrome trace JSON, for
+// chrome://tracing or ui.perfetto.dev; critical-path walks the same trace
+// back from the last service to come up, or the one named, through the
+// dependency that held up each start.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "init_ctl.h"
+
+static const char *const op_names[] = {"status", "start", "stop", "restart", "switch", "snapshot", "metrics", "trace",
+                                       "reexec"};
+
+int usage(const char *prog) {
+    fprintf(stderr, "Usage: %s {status|start|stop|restart} <service>...\n       %s switch <runlevel>\n"
+                    "       %s {snapshot|metrics|trace|reexec}\n       %s critical-path [service]\n",
+            prog, prog, prog, prog);
+    return EXIT_FAILURE;
+}
+
+// Receive a response that carries a memfd; returns the fd or -1.
+int receive_memfd(int fd, const char *what) {
+    CtlResponse resp;
+    struct iovec iov = {&resp, sizeof(resp)};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                         .msg_controllen = sizeof(control.buf)};
+    if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) != sizeof(resp)) {
+        fprintf(stderr, "Bad response from init\n");
+        return -1;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (resp.status != CTL_OK || !cmsg || cmsg->cmsg_type != SCM_RIGHTS) {
+        fprintf(stderr, "%s: %s\n", what, resp.status < CTL_ERR_COUNT ? ctl_status_names[resp.status] : "error");
+        return -1;
+    }
+    int memfd;
+    memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+    return memfd;
+}
+
+int print_metrics(int fd) {
+    int metrics = receive_memfd(fd, "metrics");
+    if (metrics < 0) return EXIT_FAILURE;
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(metrics, buf, sizeof(buf))) > 0) {
+        fwrite(buf, 1, n, stdout);
+    }
+    close(metrics);
+    return n < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Receive the snapshot response and print the table it carries.
+int print_snapshot(int fd) {
+    int snapshot = receive_memfd(fd, "snapshot");
+    if (snapshot < 0) return EXIT_FAILURE;
+
+    CtlSnapshotHeader header;
+    if (pread(snapshot, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, CTL_SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "snapshot: bad header\n");
+        return EXIT_FAILURE;
+    }
+    const char *map = mmap(NULL, header.size, PROT_READ, MAP_PRIVATE, snapshot, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+    const CtlServiceRecord *records = (const CtlServiceRecord *)(map + sizeof(header));
+    printf("Runlevel %u, %u services\n", header.runlevel, header.count);
+    printf("%-32s %-10s %8s %8s %10s %10s %4s\n", "SERVICE", "STATE", "PID", "RESTARTS", "UPTIME", "MEMORY", "CPU");
+    for (uint32_t k = 0; k < header.count; k++) {
+        const CtlServiceRecord *r = &records[k];
+        printf("%-32s %-10s %8d %8u %9.1fs %10d %3d%%\n", map + header.strings + r->name,
+               r->state < STATE_COUNT ? state_names[r->state] : "?", r->pid, r->restart_count, r->uptime_ms / 1000.0,
+               r->memory_limit, r->cpu_limit);
+    }
+    munmap((void *)map, header.size);
+    close(snapshot);
+    return EXIT_SUCCESS;
+}
+
+// Receive the trace response and map it; returns the header or NULL.
+const CtlTraceHeader *map_trace(int fd) {
+    int trace = receive_memfd(fd, "trace");
+    if (trace < 0) return NULL;
+    CtlTraceHeader header;
+    if (pread(trace, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, CTL_TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "trace: bad header\n");
+        close(trace);
+        return NULL;
+    }
+    const CtlTraceHeader *map = mmap(NULL, header.size, PROT_READ, MAP_PRIVATE, trace, 0);
+    close(trace);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    if (map->dropped) {
+        fprintf(stderr, "trace: %u events after the first %u were not recorded\n", map->dropped, map->count);
+    }
+    return map;
+}
+
+void print_json_string(const char *s) {
+    putchar('"');
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            printf("\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            printf("\\u%04x", *s);
+        } else {
+            putchar(*s);
+        }
+    }
+    putchar('"');
+}
+
+// Per-service state while turning trace events into slices
+typedef struct {
+    uint64_t wait_from; // Waiting for dependencies since, 0 if not
+    uint64_t spawn_at;  // 0 if not spawned
+    uint64_t ready_at;  // 0 if not up
+} TraceSlices;
+
+void print_slice(int tid, const char *name, uint64_t from, uint64_t to) {
+    printf(",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"name\":\"%s\",\"ts\":%llu,\"dur\":%llu}", tid, name,
+           (unsigned long long)from, (unsigned long long)(to - from));
+}
+
+// Chrome trace JSON: one track per service, with slices for the time it
+// waited on dependencies, was starting and was running, and a flow arrow
+// from each dependency that came up to the service it unblocked. Timestamps
+// are CLOCK_MONOTONIC us, i.e. time since the kernel booted.
+int print_trace(int fd) {
+    const CtlTraceHeader *h = map_trace(fd);
+    if (!h) return EXIT_FAILURE;
+    const CtlTraceEvent *events = (const CtlTraceEvent *)(h + 1);
+    const char *names = (const char *)h + h->strings;
+    uint32_t names_len = h->size - h->strings;
+    int *tids = calloc(names_len, sizeof(int)); // Name offset -> track, 0 for none yet
+    TraceSlices *slices = calloc(names_len, sizeof(TraceSlices));
+    if (!tids || !slices) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+    int tid_count = 0;
+    uint64_t loaded_at = h->start_us;
+
+    printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    printf("{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"init\"}}");
+    printf(",\n{\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,\"name\":\"init started\",\"ts\":%llu}",
+           (unsigned long long)h->start_us);
+    for (uint32_t k = 0; k < h->count; k++) {
+        const CtlTraceEvent *e = &events[k];
+        if (e->service >= names_len || e->cause >= names_len) continue;
+        unsigned long long ts = e->time_us;
+        if (e->type == TRACE_CONFIG_LOADED) {
+            printf(",\n{\"ph\":\"X\",\"pid\":1,\"tid\":0,\"name\":\"load inittab\",\"ts\":%llu,\"dur\":%d}",
+                   ts - e->arg, e->arg);
+            loaded_at = e->time_us;
+            continue;
+        }
+        if (!tids[e->service]) {
+            tids[e->service] = ++tid_count;
+            printf(",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":", tid_count);
+            print_json_string(names + e->service);
+            printf("}}");
+            slices[e->service].wait_from = loaded_at;
+        }
+        int tid = tids[e->service];
+        TraceSlices *s = &slices[e->service];
+        switch (e->type) {
+        case TRACE_UNBLOCKED:
+            if (s->wait_from) print_slice(tid, "waiting for dependencies", s->wait_from, e->time_us);
+            s->wait_from = 0;
+            if (tids[e->cause]) {
+                printf(",\n{\"ph\":\"s\",\"id\":%u,\"pid\":1,\"tid\":%d,\"name\":\"dependency\",\"cat\":\"dependency\","
+                       "\"ts\":%llu}", k, tids[e->cause], (unsigned long long)slices[e->cause].ready_at);
+                printf(",\n{\"ph\":\"f\",\"bp\":\"e\",\"id\":%u,\"pid\":1,\"tid\":%d,\"name\":\"dependency\","
+                       "\"cat\":\"dependency\",\"ts\":%llu}", k, tid, ts);
+            }
+            break;
+        case TRACE_SPAWN:
+            if (s->wait_from && s->wait_from < e->time_us && s->wait_from != loaded_at) {
+                print_slice(tid, "restart delay", s->wait_from, e->time_us);
+            }
+            s->wait_from = 0;
+            s->spawn_at = e->time_us;
+            break;
+        case TRACE_EXEC:
+            if (s->spawn_at) print_slice(tid, e->arg ? "exec failed" : "spawn", s->spawn_at, e->time_us);
+            break;
+        case TRACE_READY:
+            if (e->pid == 0) {
+                printf(",\n{\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"name\":\"listening\",\"ts\":%llu}", tid, ts);
+            } else if (s->spawn_at) {
+                print_slice(tid, "starting", s->spawn_at, e->time_us);
+            }
+            s->wait_from = 0;
+            s->ready_at = e->time_us;
+            break;
+        case TRACE_EXIT:
+            if (s->ready_at || s->spawn_at) {
+                print_slice(tid, "running", s->ready_at ? s->ready_at : s->spawn_at, e->time_us);
+            }
+            printf(",\n{\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"name\":\"exit\",\"ts\":%llu,"
+                   "\"args\":{\"status\":%d}}", tid, ts, e->arg);
+            s->spawn_at = s->ready_at = 0;
+            s->wait_from = e->time_us;
+            break;
+        }
+    }
+
+    // Close the slices of services still up when the trace was taken
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t now_us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    for (uint32_t n = 0; n < names_len; n++) {
+        if (tids[n] && slices[n].ready_at) print_slice(tids[n], "running", slices[n].ready_at, now_us);
+    }
+    printf("\n]}\n");
+    free(tids);
+    free(slices);
+    munmap((void *)h, h->size);
+    return EXIT_SUCCESS;
+}
+
+// Index of the last event before 'before' that is about service (any type in
+// mask), or -1. A mask bit is 1 << TraceEventType.
+int trace_find(const CtlTraceEvent *events, int before, uint32_t service, uint32_t mask) {
+    for (int k = before - 1; k >= 0; k--) {
+        if ((mask >> events[k].type & 1) && (events[k].service == service || events[k].type == TRACE_CONFIG_LOADED)) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+// Walk back from the target's first readiness: it was spawned when its last
+// missing dependency came up, which was spawned when its own last one came
+// up, and so on to the inittab load. Each step shows how long the service
+// took from spawn to ready, and how long it sat unspawned after being
+// unblocked, e.g. during a restart delay.
+int print_critical_path(int fd, const char *target) {
+    const CtlTraceHeader *h = map_trace(fd);
+    if (!h) return EXIT_FAILURE;
+    const CtlTraceEvent *events = (const CtlTraceEvent *)(h + 1);
+    const char *names = (const char *)h + h->strings;
+
+    // The target's first READY, or else the first READY of whichever service came up last
+    int ready = -1;
+    for (int k = 0; k < (int)h->count; k++) {
+        if (events[k].type != TRACE_READY) continue;
+        if (target && strcmp(names + events[k].service, target) == 0) {
+            ready = k;
+            break;
+        }
+        if (!target && trace_find(events, k, events[k].service, 1 << TRACE_READY) < 0) ready = k;
+    }
+    if (ready < 0) {
+        fprintf(stderr, "critical-path: %s has not come up\n", target ? target : "nothing");
+        munmap((void *)h, h->size);
+        return EXIT_FAILURE;
+    }
+
+    int *steps = malloc(h->count * sizeof(int) * 2); // Pairs of (spawn or -1, ready) event indexes
+    int step_count = 0, root = -1;
+    while (ready >= 0) {
+        uint32_t service = events[ready].service;
+        int spawn = -1;
+        int k = trace_find(events, ready, service, 1 << TRACE_SPAWN | 1 << TRACE_EXIT | 1 << TRACE_READY |
+                                                       1 << TRACE_CONFIG_LOADED);
+        if (k >= 0 && events[k].type == TRACE_SPAWN) spawn = k;
+        steps[2 * step_count] = spawn;
+        steps[2 * step_count + 1] = ready;
+        step_count++;
+        if (step_count == (int)h->count) break; // Cannot happen for a well-formed trace
+
+        int from = spawn >= 0 ? spawn : ready;
+        k = trace_find(events, from, service, 1 << TRACE_UNBLOCKED | 1 << TRACE_EXIT | 1 << TRACE_CONFIG_LOADED);
+        ready = -1;
+        if (k >= 0 && events[k].type == TRACE_UNBLOCKED) {
+            ready = trace_find(events, k, events[k].cause, 1 << TRACE_READY);
+        }
+        root = k;
+    }
+
+    uint64_t start = h->start_us;
+    printf("%10s %10s %10s  %s\n", "SPAWNED", "WAITED", "STARTUP", "SERVICE");
+    if (root >= 0 && events[root].type == TRACE_CONFIG_LOADED) {
+        printf("%9.1fms %10s %8.1fms  (inittab loaded)\n", (events[root].time_us - start) / 1000.0, "",
+               events[root].arg / 1000.0);
+    } else if (root >= 0 && events[root].type == TRACE_EXIT) {
+        printf("%9.1fms %10s %10s  (%s exited)\n", (events[root].time_us - start) / 1000.0, "", "",
+               names + events[root].service);
+    }
+    uint64_t previous = root >= 0 ? events[root].time_us : start;
+    for (int n = step_count - 1; n >= 0; n--) {
+        const CtlTraceEvent *r = &events[steps[2 * n + 1]];
+        uint64_t spawned = steps[2 * n] >= 0 ? events[steps[2 * n]].time_us : r->time_us;
+        printf("%9.1fms %8.1fms %8.1fms  %s%s\n", (spawned - start) / 1000.0, (spawned - previous) / 1000.0,
+               (r->time_us - spawned) / 1000.0, names + r->service, steps[2 * n] < 0 ? " (listening)" : "");
+        previous = r->time_us;
+    }
+    printf("%s is up %.1f ms after init started, %.3f s after the kernel booted\n",
+           names + events[steps[1]].service, (previous - start) / 1000.0, previous / 1e6);
+    free(steps);
+    munmap((void *)h, h->size);
+    return EXIT_SUCCESS;
+}
+
+int send_request(int fd, uint32_t tag, CtlOp op, const char *name, uint16_t arg) {
+    char buf[sizeof(CtlRequest) + CTL_NAME_MAX];
+    size_t len = name ? strlen(name) : 0;
+    if (len > CTL_NAME_MAX) {
+        fprintf(stderr, "%s: name too long\n", name);
+        return -1;
+    }
+    CtlRequest req = {tag, op, len, arg};
+    memcpy(buf, &req, sizeof(req));
+    memcpy(buf + sizeof(req), name, len);
+    if (send(fd, buf, sizeof(req) + len, 0) < 0) {
+        perror("send");
+        return -1;
+    }
+    return 0;
+}
+
+// The answer comes before the exec, so success only means it was accepted.
+int print_reexec(int fd) {
+    CtlResponse resp;
+    if (recv(fd, &resp, sizeof(resp), 0) != sizeof(resp)) {
+        fprintf(stderr, "Bad response from init\n");
+        return EXIT_FAILURE;
+    }
+    if (resp.status != CTL_OK) {
+        fprintf(stderr, "reexec: %s\n", resp.status < CTL_ERR_COUNT ? ctl_status_names[resp.status] : "error");
+        return EXIT_FAILURE;
+    }
+    printf("Re-executing init\n");
+    return EXIT_SUCCESS;
+}
+
+// A runlevel argument, or -1 if it is not one
+int parse_runlevel(const char *arg) {
+    char *end;
+    long runlevel = strtol(arg, &end, 10);
+    if (end == arg || *end || runlevel < 0 || runlevel >= MAX_RUNLEVELS) {
+        fprintf(stderr, "%s: not a runlevel, expected 0 to %d\n", arg, MAX_RUNLEVELS - 1);
+        return -1;
+    }
+    return runlevel;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        return usage(argv[0]);
+    }
+    int op = 0;
+    bool critical_path = strcmp(argv[1], "critical-path") == 0;
+    while (op < CTL_OP_COUNT && strcmp(argv[1], op_names[op]) != 0) op++;
+    if (critical_path && argc <= 3) {
+        op = CTL_TRACE;
+    } else if (op == CTL_OP_COUNT || (op >= CTL_SNAPSHOT) != (argc == 2) || (op == CTL_SWITCH && argc != 3)) {
+        return usage(argv[0]);
+    }
+    int runlevel = op == CTL_SWITCH ? parse_runlevel(argv[2]) : 0;
+    if (runlevel < 0) {
+        return EXIT_FAILURE;
+    }
+
+    // INIT_ROOT points at a supervisor started with the same variable
+    const char *root = getenv("INIT_ROOT");
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s%s", root ? root : "", CTL_SOCKET_PATH);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Cannot connect to %s: %s\n", addr.sun_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (op >= CTL_SNAPSHOT) {
+        int status = EXIT_FAILURE;
+        if (send_request(fd, 0, op, NULL, 0) == 0) {
+            status = critical_path       ? print_critical_path(fd, argc == 3 ? argv[2] : NULL)
+                     : op == CTL_SNAPSHOT ? print_snapshot(fd)
+                     : op == CTL_METRICS  ? print_metrics(fd)
+                     : op == CTL_TRACE    ? print_trace(fd)
+                                          : print_reexec(fd);
+        }
+        close(fd);
+        return status;
+    }
+
+    // Tags are argv indexes, so answers map straight back to their service
+    int sent = 0;
+    for (int k = 2; k < argc; k++, sent++) {
+        int r = op == CTL_SWITCH ? send_request(fd, k, op, NULL, runlevel) : send_request(fd, k, op, argv[k], 0);
+        if (r < 0) break;
+    }
+
+    int status = EXIT_SUCCESS;
+    for (int n = 0; n < sent; n++) {
+        CtlResponse resp;
+        if (recv(fd, &resp, sizeof(resp), 0) != sizeof(resp) || resp.tag < 2 || resp.tag >= (uint32_t)argc) {
+            fprintf(stderr, "Bad response from init\n");
+            return EXIT_FAILURE;
+        }
+        const char *what = argv[resp.tag];
+        if (resp.status != CTL_OK) {
+            const char *error = resp.status < CTL_ERR_COUNT ? ctl_status_names[resp.status] : "error";
+            fprintf(stderr, "%s: %s\n", what, error);
+            status = EXIT_FAILURE;
+        } else if (op == CTL_SWITCH) {
+            printf("Runlevel %u\n", resp.runlevel);
+        } else {
+            const char *state = resp.state < STATE_COUNT ? state_names[resp.state] : "?";
+            if (resp.pid > 0) {
+                printf("%s: %s (PID %d, %u restarts)\n", what, state, resp.pid, resp.restart_count);
+            } else {
+                printf("%s: %s\n", what, state);
+            }
+        }
+    }
+    close(fd);
+    return status;
+}